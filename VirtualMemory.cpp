@@ -3,8 +3,108 @@
 //
 
 #include "VirtualMemory.h"
+#include "VirtualMemoryExtensions.h"
 #include "PhysicalMemory.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+
+#if defined(VM_VICTIM_SEARCH_BUDGET) && defined(VM_EVICTION_SAMPLES)
+#error "VM_VICTIM_SEARCH_BUDGET and VM_EVICTION_SAMPLES select different victim searches"
+#endif
+
+// scoring of the sampled victims (VM_EVICTION_SAMPLES) - the page with the highest score is evicted
+#define VM_SCORE_CYCLIC_DISTANCE 0  // the maximal cyclic distance from the page swapped in
+#define VM_SCORE_LRU 1  // the page that was accessed least recently
+#define VM_SCORE_LFU 2  // the page that was accessed least frequently
+
+#ifndef VM_EVICTION_SCORE
+#define VM_EVICTION_SCORE VM_SCORE_CYCLIC_DISTANCE
+#endif
+
+#ifdef VM_SEARCH_THREADS
+// the victim search reads the tables from VM_SEARCH_THREADS threads at once while the faulting
+// thread waits for it - the engine is still single-threaded otherwise, but PMread must allow
+// concurrent calls as long as nothing is written to the physical memory
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+static_assert(VM_SEARCH_THREADS > 1, "VM_SEARCH_THREADS counts the faulting thread too");
+
+// trees with fewer frames in use are searched on the faulting thread - waking the workers would
+// cost more than the search
+#ifndef VM_PARALLEL_MIN_FRAMES
+#define VM_PARALLEL_MIN_FRAMES 4096
+#endif
+#endif
+
+// number of pages that can be pinned at the same time
+#ifndef VM_HAZARD_SLOTS
+#define VM_HAZARD_SLOTS 4
+#endif
+
+// number of last level tables kept by the walk cache
+#ifndef VM_WALK_CACHE_ENTRIES
+#define VM_WALK_CACHE_ENTRIES 16
+#endif
+
+// number of extents kept by the translation cache
+#ifndef VM_TLB_EXTENTS
+#define VM_TLB_EXTENTS 8
+#endif
+
+static_assert((uint64_t) NUM_FRAMES - 1 <= (uint64_t) std::numeric_limits<word_t>::max(),
+              "frame numbers do not fit in a table entry");
+
+#if defined(VM_ADMISSION_FILTER) || defined(VM_STREAMING_READS)
+// the last frame is kept out of the tree - pages that are not admitted and pages streamed by
+// VMreadRange are served through it without being mapped
+#define BOUNCE_FRAME (NUM_FRAMES - 1)
+#define USABLE_FRAMES (NUM_FRAMES - 1)
+#else
+#define USABLE_FRAMES NUM_FRAMES
+#endif
+
+// VM_CHECK_INTERVAL=n checks the consistency of the tables after every n operations that access
+// the virtual memory or change the tables, and aborts if it is broken (for debug builds)
+
+#if defined(VM_ZERO_PAGE_READS) && !defined(VM_DROP_CLEAN_PAGES)
+// reads of pages that were never written return zeros without mapping them, so a page has to hold
+// zeros when it is mapped for the first write
+#define VM_DROP_CLEAN_PAGES
+#endif
+
+#ifdef VM_ZERO_PAGE_READS
+// returned by the translation of a read of a page that was never written - the read is answered
+// with zeros, and no frame is mapped for it
+#define ZERO_FRAME NUM_FRAMES
+#endif
+
+#ifdef VM_FAST_FRAMES
+// frames [0, VM_FAST_FRAMES) are the fast tier and the other frames are the slow tier - a page in
+// the slow tier is promoted after this many accesses
+#ifndef VM_PROMOTE_ACCESSES
+#define VM_PROMOTE_ACCESSES 4
+#endif
+#define NUM_TIERS 2
+static_assert(VM_FAST_FRAMES > 1 && VM_FAST_FRAMES < USABLE_FRAMES,
+              "both tiers must have frames for pages");
+#else
+#define NUM_TIERS 1
+#endif
+
+#ifdef VM_ADMISSION_FILTER
+// rows and counters per row of the count-min sketch that estimates the access frequency of pages
+#define SKETCH_DEPTH 4
+#ifndef VM_SKETCH_WIDTH
+#define VM_SKETCH_WIDTH (4 * NUM_FRAMES)
+#endif
+#endif
+
 
 /**
  * Struct that keeps the arguments needed for the DFS search for frame
@@ -13,14 +113,172 @@ struct SearchArguments {
     word_t currentFrame;  // the current frame that should not be evicted
     word_t maxFrame;  // the maximum frame index we have seen so far
     uint64_t pageNumber;  // the virtual page number we want to map to a physical address
-    int maxCyclicFrame;  // the frame that has the maximal cyclic distance
+    word_t maxCyclicFrame;  // the frame that has the maximal cyclic distance
     int maxCyclicDist;  // the current maximal cyclic distance
     uint64_t maxCyclicPage;  // the page that has the maximal cyclic distance
     uint64_t maxCyclicParent;  // the parent of the frame that has the maximal cyclic distance
-    int emptyFrame;  // the frame with an empty table (if exists)
-    int priority;  // the priority {1, 2, 3} of the chosen frame
+    word_t emptyFrame;  // the frame with an empty table (if exists)
+    int priority;  // the priority {1, 2, 3} of the chosen frame (0 if the page is not admitted)
+    int maxCyclicClass;  // the quota class of the page that has the maximal cyclic distance
+    uint64_t emptyParent;  // the entry that points to the frame with an empty table
+    uint64_t framesScanned;  // the number of frames the search has examined
+};
+
+
+/**
+ * A run of consecutive virtual pages that are mapped to consecutive frames
+ */
+struct TranslationExtent {
+    uint64_t pageBase;  // the first virtual page of the run
+    uint64_t frameBase;  // the frame the first page is mapped to
+    uint64_t length;  // the number of pages in the run (0 if the extent is empty)
+};
+
+// the translation cache - bulk loads fill an extent page after page
+TranslationExtent cachedExtents[VM_TLB_EXTENTS];
+
+// the extent that is replaced when a page does not continue any of the cached extents
+int nextExtent = 0;
+
+// incremented whenever a mapped page is unmapped or moved, before its frame is reused
+uint64_t mappingEpoch = 0;
+
+/**
+ * A last level table cached by the prefix of the pages it maps, so a walk can start right at it
+ */
+struct WalkCacheEntry {
+    uint64_t prefix;  // the virtual page number without its last offset
+    word_t table;  // the frame of the last level table of these pages
+    uint64_t version;  // the version of the frame when it was cached (0 if the entry is empty)
+};
+
+// the walk cache, indexed by the prefix
+WalkCacheEntry walkCache[VM_WALK_CACHE_ENTRIES];
+
+// incremented whenever a frame is linked to the tree or moved - an entry of the walk cache is
+// valid as long as the version of its frame has not changed
+uint64_t frameVersions[NUM_FRAMES];
+
+// hazard slots - frames of pinned pages, which are neither evicted nor moved until unpinned
+word_t hazardFrames[VM_HAZARD_SLOTS];
+int hazardCount = 0;
+
+#ifdef BOUNCE_FRAME
+// whether the page in the bounce frame goes back to the swap when it is released - it was restored
+// from the swap or written meanwhile (a page that was never written has nothing to keep)
+bool bounceDirty = false;
+#endif
+
+
+/**
+ * Reverse mapping of a frame - where the frame is linked from in the tree of tables
+ */
+struct FrameInfo {
+    uint64_t parentEntry;  // the physical address of the table entry that points to the frame
+    uint64_t page;  // the virtual page the frame was linked for (its own page if it is a leaf)
+    bool isLeaf;  // whether the frame holds a page (and not a table)
+    uint64_t residentSlot;  // the index of the frame in residentFrames (only for leaves)
+    uint64_t lastAccess;  // the access clock of the last access to the page (only for leaves)
+    uint64_t accessCount;  // the number of accesses to the page since it was mapped
+    word_t children;  // the number of non-zero entries (only for tables)
+    uint64_t emptyTablesBelow;  // the number of empty tables in the subtree (the frame included)
+    uint64_t pagesBelow;  // the number of pages in the subtree (the frame included)
+    bool clean;  // the page holds the zeros it was filled with when mapped (VM_DROP_CLEAN_PAGES)
+};
+
+// the reverse map of every frame in use (frame 0 is the root and has no parent)
+FrameInfo frames[NUM_FRAMES];
+
+// dense array of the frames that hold pages, so a random resident page can be picked in O(1)
+word_t residentFrames[NUM_FRAMES];
+uint64_t residentCount = 0;
+
+// incremented on every translation, orders the accesses for the LRU score
+uint64_t accessClock = 0;
+
+// frames are always handed out as a prefix of the physical memory - [0, usedFrames) are in use
+word_t usedFrames = 1;
+
+// paging counters since the last VMinitialize
+VMstats stats = {0, 0, 0, 0, 0, 0, 0, 0};
+VMtierStats tierStats[NUM_TIERS];
+
+// bitmap of the pages that have a copy in the swap (restoring a page removes its copy). It is kept
+// across VMinitialize, since the copies stay in the swap and are restored when the page is mapped
+uint64_t swappedPages[(NUM_PAGES + 63) / 64];
+
+// the heap of VMalloc - a page is free, a slab of slots of one size class (slots of 1, 2, 4 ...
+// PAGE_SIZE / 2 words) or a page of an allocation of whole pages
+#define HEAP_FREE 0  // size class c is stored as c + 1
+#define HEAP_LARGE (OFFSET_WIDTH + 1)  // the first page of an allocation of whole pages
+#define HEAP_LARGE_TAIL (OFFSET_WIDTH + 2)  // the other pages of an allocation of whole pages
+
+/**
+ * A page of the heap
+ */
+struct HeapPage {
+    uint8_t kind;  // HEAP_FREE, size class + 1, HEAP_LARGE or HEAP_LARGE_TAIL
+    uint64_t count;  // slots in use in a slab, or pages of an allocation
+    uint64_t* slots;  // bitmap of the slots of a slab that hold an allocation (null otherwise)
+};
+
+/**
+ * The bookkeeping of the heap - allocated by the first VMalloc and released by VMinitialize, so
+ * programs that do not use the heap pay nothing for it
+ */
+struct Heap {
+    HeapPage pages[NUM_PAGES];
+    uint64_t partialSlabs[OFFSET_WIDTH][(NUM_PAGES + 63) / 64];  // slabs with free slots
+    uint64_t usedPages[(NUM_PAGES + 63) / 64];  // the pages that are not free
+};
+
+Heap* heap = nullptr;
+
+
+/**
+ * Frame quota and counters of a region - the part of the virtual memory mapped by one entry of
+ * the root table
+ */
+struct RegionQuota {
+    uint64_t minFrames;  // the region's pages are not evicted while it uses at most this many frames
+    uint64_t maxFrames;  // the region never uses more frames than this (0 if unlimited)
+    VMregionStats stats;  // the frames used by the region and its paging counters
 };
 
+// the quota of every entry of the root table
+RegionQuota regions[PAGE_SIZE];
+
+#ifdef VM_VICTIM_SEARCH_BUDGET
+// the position in the reverse map the next bounded victim search resumes from
+uint64_t searchCursor = 0;
+#endif
+
+#ifdef VM_ADMISSION_FILTER
+// the count-min sketch - saturating counters, halved every 10 * VM_SKETCH_WIDTH additions so the
+// estimates follow the recent accesses
+uint8_t sketch[SKETCH_DEPTH][VM_SKETCH_WIDTH];
+uint64_t sketchAdditions = 0;
+
+// multipliers that hash a page to a different counter in every row
+const uint64_t SKETCH_SEEDS[SKETCH_DEPTH] = {0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL,
+                                             0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL};
+#endif
+
+#ifdef VM_SEARCH_THREADS
+// the best victim the workers of the running search have found, as class << 32 | distance - every
+// worker skips the subtrees that cannot beat it, not only those that cannot beat its own best
+std::atomic<uint64_t> searchBound(0);
+#endif
+
+#ifdef VM_EVICTION_SAMPLES
+// tables that an eviction left empty - candidates for the 1st priority without searching the tree
+word_t emptyTables[NUM_FRAMES];
+uint64_t emptyTablesCount = 0;
+
+// state of the xorshift generator that picks the sampled pages
+uint64_t sampleSeed = 1;
+#endif
+
 
 /**
  * Divides the virtual address to an array of offsets.
@@ -62,240 +320,3239 @@ int cyclic_distance(uint64_t page_swapped_in, uint64_t p) {
 
 
 /**
- * Updates the maximal cyclic distance if needed
+ * Reads the frame a table entry points to
  *
- * @param args Arguments provided for the DFS
- * @param rootFrame The root frame of the current recursion level
- * @param currentVirtual The virtual address of the root frame
- * @param parent The parent of the current root frame (in the tree)
- * @param offset The last frame's offset
+ * @param entry The physical address of the table entry
+ * @return The frame, or 0 if the entry is empty
  */
-void update_max_cyclic_distance(SearchArguments* args, word_t rootFrame, uint64_t currentVirtual,
-                                uint64_t parent, uint64_t offset) {
-    int cyclicDist = cyclic_distance(args->pageNumber, currentVirtual);
+word_t read_entry(uint64_t entry) {
+    word_t value;
+    PMread(entry, &value);
+    return value;
+}
 
-    // check if a larger distance was found and update accordingly
-    if (cyclicDist >= args->maxCyclicDist) {
-        args->maxCyclicFrame = rootFrame;
-        args->maxCyclicDist = cyclicDist;
-        args->maxCyclicPage = currentVirtual;
-        args->maxCyclicParent = parent * PAGE_SIZE + offset;
-    }
+
+/**
+ * Points a table entry at a frame
+ *
+ * @param entry The physical address of the table entry
+ * @param frame The frame (not the root)
+ */
+void write_entry(uint64_t entry, word_t frame) {
+    PMwrite(entry, frame);
 }
 
 
 /**
- * Handles the case an empty frame was not founds and checks for the other priorities - an unused
- * frame or eviction of a frame
- * 
- * @param args Arguments provided for the DFS
+ * Finds the region (entry of the root table) a page belongs to
+ *
+ * @param pageNumber The virtual page number
+ * @return The index of the region
  */
-void empty_frame_not_found(SearchArguments* args) {
-    // check if there is an unused frame
-    if (args->maxFrame + 1 < NUM_FRAMES) {
-        args->priority = 2;
-        return;
-    }
+uint64_t region_of(uint64_t pageNumber) {
+    return (pageNumber >> (OFFSET_WIDTH * (TABLES_DEPTH - 1))) & (PAGE_SIZE - 1);
+}
 
-    // no available frames - need to evict
-    PMwrite(args->maxCyclicParent, 0);
-    PMevict(args->maxCyclicFrame, args->maxCyclicPage);
-    args->priority = 3;
+
+/**
+ * Checks whether the region of a page uses its maximal number of frames
+ *
+ * @param pageNumber The virtual page number
+ * @return True if the region may not get any more frames
+ */
+bool region_at_max(uint64_t pageNumber) {
+    RegionQuota* quota = &regions[region_of(pageNumber)];
+    return quota->maxFrames != 0 && quota->stats.frames >= quota->maxFrames;
 }
 
 
 /**
- * Choose the frame by traversing the entire tree of tables in the physical memory while looking
- * for one of the following (prioritized):
- * (1) Frame with an empty table
- * (2) Unused frame
- * (3) Evict the frame that contains a page with the maximal cyclical distance
+ * Classifies a page as a victim by the quota of its region - pages of a higher class are evicted
+ * first, and the cyclic distance only decides between pages of the same class:
+ * 3 - the faulting region is at its maximum and the page is its own
+ * 2 - the region of the page uses more frames than its maximum
+ * 1 - the region of the page is within its quota
+ * 0 - the region of the page uses no more than its minimum
  *
- * @param args Arguments provided for the DFS
- * @param rootFrame The root frame of the current recursion level
- * @param currentVirtual The virtual address of the root frame
- * @param parent The parent of the current root frame (in the tree)
- * @param depth The current depth we have reached so far in the tree
- * @param offset The last frame's offset
+ * @param args Arguments provided for the search
+ * @param pageNumber The page that we consider to swap out
+ * @return The class of the page
  */
-void find_next_frame(SearchArguments* args, word_t rootFrame, uint64_t currentVirtual,
-                    uint64_t parent, uint64_t depth, uint64_t offset) {
+int quota_class(SearchArguments* args, uint64_t pageNumber) {
+    uint64_t region = region_of(pageNumber);
+    if (region == region_of(args->pageNumber) && region_at_max(args->pageNumber)) {
+        return 3;
+    }
 
-    // reached the leaves - need to calculate the cyclic distance and update
-    if (depth == TABLES_DEPTH) {
-        update_max_cyclic_distance(args, rootFrame, currentVirtual, parent, offset);
-        return;
+    RegionQuota* quota = &regions[region];
+    if (quota->maxFrames != 0 && quota->stats.frames > quota->maxFrames) {
+        return 2;
+    }
+    if (quota->stats.frames <= quota->minFrames) {
+        return 0;
     }
+    return 1;
+}
 
-    // check if the current root frame is empty (contains a non-zero page)
-    bool isCurrentRootEmpty = true;
-    for (int i = 0; i < PAGE_SIZE; i++) {
-        word_t value;
-        PMread(rootFrame * PAGE_SIZE + i, &value);
 
-        // this frame contains a non-zero page
-        if (value != 0) {
-            isCurrentRootEmpty = false;
-            break;
+/**
+ * Checks whether the page swapped in may take a frame that is not used yet
+ *
+ * @param args Arguments provided for the search
+ * @return True if there is an unused frame and the region of the page is below its maximum
+ */
+bool has_unused_frame(SearchArguments* args) {
+    return args->maxFrame + 1 < USABLE_FRAMES && !region_at_max(args->pageNumber);
+}
+
+
+/**
+ * Checks whether the page swapped in may take the given empty table - a region at its maximum
+ * can only reuse its own tables
+ *
+ * @param args Arguments provided for the search
+ * @param frame The frame of the empty table
+ * @return True if the table can be reused
+ */
+bool may_reuse_table(SearchArguments* args, word_t frame) {
+    return !region_at_max(args->pageNumber) ||
+           region_of(frames[frame].page) == region_of(args->pageNumber);
+}
+
+
+/**
+ * Checks whether the given frame is published in one of the hazard slots
+ *
+ * @param frame The frame
+ * @return True if the frame holds a pinned page
+ */
+bool is_hazard(word_t frame) {
+    for (int i = 0; i < hazardCount; i++) {
+        if (hazardFrames[i] == frame) {
+            return true;
         }
     }
+    return false;
+}
 
-    // check the current root frame is empty & valid for being the next frame
-    if (rootFrame != 0 && rootFrame != args->currentFrame && isCurrentRootEmpty) {
-        args->emptyFrame = rootFrame;
-        PMwrite(parent * PAGE_SIZE + offset, 0);
-        args->priority = 1;
-        return;
-    }
 
-    // search for empty/unused frames
-    int nextFrame = 0;
+/**
+ * Checks whether the search has seen a page it may evict - a region at its maximum has to evict
+ * one of its own pages
+ *
+ * @param args Arguments provided for the search
+ * @return True if the chosen victim can be evicted
+ */
+bool has_valid_victim(SearchArguments* args) {
+    return args->maxCyclicFrame != 0 &&
+           (args->maxCyclicClass == 3 || !region_at_max(args->pageNumber));
+}
 
-    for (int i = 0; i < PAGE_SIZE; i++) {
-        PMread(rootFrame * PAGE_SIZE + i, &nextFrame);
 
-        // there is a next frame in the path (the current frame is not empty)
-        if (nextFrame != 0) {
-            if (nextFrame >= args->maxFrame) {
-                args->maxFrame = nextFrame;
-            }
+#ifdef VM_SEARCH_THREADS
+/**
+ * Packs a quota class and a cyclic distance into a bound of the parallel search - a better victim
+ * has a higher bound
+ *
+ * @param victimClass The quota class
+ * @param cyclicDist The cyclic distance
+ * @return The bound
+ */
+uint64_t pack_bound(int victimClass, int cyclicDist) {
+    return ((uint64_t) victimClass << 32) | (uint32_t) cyclicDist;
+}
 
-            find_next_frame(args, nextFrame, (currentVirtual << OFFSET_WIDTH) + i, rootFrame,
-                            depth + 1, i);
 
-            // an empty frame was found during the DFS search
-            if (args->priority == 1) {
-                return;
-            }
-        }
+/**
+ * Raises the bound of the running search to the victim a worker has just found, if it is better
+ *
+ * @param args Arguments of the search of the worker
+ */
+void publish_bound(SearchArguments* args) {
+    uint64_t bound = pack_bound(args->maxCyclicClass, args->maxCyclicDist);
+    uint64_t current = searchBound.load(std::memory_order_relaxed);
+
+    while (current < bound &&
+           !searchBound.compare_exchange_weak(current, bound, std::memory_order_relaxed)) {
     }
+}
+#endif
 
-    // finished the recursive search for empty frame and reached the original root frame
-    if (rootFrame == 0) {
-        empty_frame_not_found(args);
+
+/**
+ * Updates the maximal cyclic distance if needed
+ *
+ * @param args Arguments provided for the DFS
+ * @param rootFrame The root frame of the current recursion level
+ * @param currentVirtual The virtual address of the root frame
+ * @param parent The parent of the current root frame (in the tree)
+ * @param offset The last frame's offset
+ */
+void update_max_cyclic_distance(SearchArguments* args, word_t rootFrame, uint64_t currentVirtual,
+                                uint64_t parent, uint64_t offset) {
+    // pinned pages are never evicted
+    if (is_hazard(rootFrame)) {
         return;
     }
-}
 
+    int cyclicDist = cyclic_distance(args->pageNumber, currentVirtual);
+    int victimClass = quota_class(args, currentVirtual);
 
+    // check if a larger distance was found (in a class at least as high) and update accordingly
+    if (victimClass > args->maxCyclicClass ||
+        (victimClass == args->maxCyclicClass && cyclicDist >= args->maxCyclicDist)) {
+        args->maxCyclicClass = victimClass;
+        args->maxCyclicFrame = rootFrame;
+        args->maxCyclicDist = cyclicDist;
+        args->maxCyclicPage = currentVirtual;
+        args->maxCyclicParent = parent * PAGE_SIZE + offset;
+#ifdef VM_SEARCH_THREADS
+        publish_bound(args);
+#endif
+    }
+}
 
 
 /**
- * Finds the physical address of a given virtual address
+ * Looks up the given page in the cached extents
  *
- * @param virtualAddress The virtual address we want to translate
- * @param offsets Array of offsets
- * @return The physical address of the given virtual address
+ * @param pageNumber The virtual page number
+ * @param frame Output - the frame the page is mapped to (if found)
+ * @return True if the page is covered by one of the cached extents
  */
-uint64_t find_physical_address(uint64_t virtualAddress, uint64_t* offsets) {
-    int nextFrame = 0;
-
-    uint64_t pageNumber = virtualAddress >> OFFSET_WIDTH;
-    SearchArguments args = {0, 0, pageNumber, 0, 0, 0, 0, 0, 0};
-
-    for (int i = 0; i < TABLES_DEPTH; i++) {
-        PMread(args.currentFrame * PAGE_SIZE + offsets[i], &nextFrame);
+bool lookup_extent(uint64_t pageNumber, uint64_t* frame) {
+    for (int i = 0; i < VM_TLB_EXTENTS; i++) {
+        TranslationExtent* extent = &cachedExtents[i];
 
-        // need to search for the next address
-        if (nextFrame == 0) {
-            find_next_frame(&args, 0, 0, 0, 0, 0);
-            args.maxFrame++;
+        if (pageNumber - extent->pageBase < extent->length) {
+            *frame = extent->frameBase + (pageNumber - extent->pageBase);
+            return true;
+        }
+    }
 
-            // 1st priority - empty frame
-            if (args.priority == 1) {
-                nextFrame = args.emptyFrame;
-            }
+    return false;
+}
 
-            // 2nd priority - unused frame
-            else if (args.priority == 2) {
-                nextFrame = args.maxFrame;
-            }
 
-            // 3rd priority - evicted the frame with the maximal cyclic distance
-            else if (args.priority == 3) {
-                nextFrame = args.maxCyclicFrame;
-            }
+/**
+ * Records a page that was just mapped to a frame - extends a cached extent if the page and the
+ * frame continue it, otherwise starts a new extent from this page in place of an empty extent
+ * or of the oldest one
+ *
+ * @param pageNumber The virtual page number that was mapped
+ * @param frame The frame the page was mapped to
+ */
+void record_extent(uint64_t pageNumber, uint64_t frame) {
+    int replaced = -1;
 
-            PMwrite(args.currentFrame * PAGE_SIZE + offsets[i], nextFrame);
+    for (int i = 0; i < VM_TLB_EXTENTS; i++) {
+        TranslationExtent* extent = &cachedExtents[i];
 
-            // found the physical address
-            if (i == TABLES_DEPTH - 1) {
-                PMrestore(nextFrame, args.pageNumber);
-            }
+        if (extent->length > 0 && pageNumber == extent->pageBase + extent->length &&
+            frame == extent->frameBase + extent->length) {
+            extent->length++;
+            return;
+        }
 
-            // unlink it from its parent
-            else {
-                for (int j = 0; j < PAGE_SIZE; j++) {
-                    PMwrite(nextFrame * PAGE_SIZE + j, 0);
-                }
-            }
+        if (extent->length == 0 && replaced == -1) {
+            replaced = i;
         }
+    }
 
-        args = {nextFrame, 0, pageNumber, 0, 0, 0, 0, 0, 0};
+    if (replaced == -1) {
+        replaced = nextExtent;
+        nextExtent = (nextExtent + 1) % VM_TLB_EXTENTS;
     }
 
-    return nextFrame;
+    cachedExtents[replaced] = {pageNumber, frame, 1};
 }
 
 
 /**
- * Initialize the virtual memory.
+ * Shoots down the given page (and the pages after it) in the extent that covers it, so the cache
+ * never translates a page that is no longer mapped
+ *
+ * @param pageNumber The virtual page number that is being unmapped
  */
-void VMinitialize() {
-    for (int i = 0; i < PAGE_SIZE; i++) {
-        PMwrite(i, 0);
+void invalidate_extent(uint64_t pageNumber) {
+    for (int i = 0; i < VM_TLB_EXTENTS; i++) {
+        TranslationExtent* extent = &cachedExtents[i];
+
+        // the extents never overlap - no other extent covers the page
+        if (pageNumber - extent->pageBase < extent->length) {
+            extent->length = pageNumber - extent->pageBase;
+            return;
+        }
     }
 }
 
 
 /**
- * Reads a word from the given virtual address
- * and puts its content in *value.
+ * Looks up the last level table of a page in the walk cache
  *
- * returns 1 on success.
- * returns 0 on failure (if the address cannot be mapped to a physical
- * address for any reason)
+ * @param pageNumber The virtual page number
+ * @param table Output - the frame of the last level table (if found)
+ * @return True if the table is cached and it was not unlinked or moved since
  */
-int VMread(uint64_t virtualAddress, word_t* value) {
-    if (virtualAddress >= VIRTUAL_MEMORY_SIZE) {
-        return 0;
-    }
+bool lookup_walk_cache(uint64_t pageNumber, word_t* table) {
+    uint64_t prefix = pageNumber >> OFFSET_WIDTH;
+    WalkCacheEntry* entry = &walkCache[prefix % VM_WALK_CACHE_ENTRIES];
 
-    if ((virtualAddress >> OFFSET_WIDTH) >= NUM_PAGES) {
-        return 0;
+    if (entry->version == 0 || entry->prefix != prefix ||
+        frameVersions[entry->table] != entry->version) {
+        return false;
     }
 
-    uint64_t offsets[TABLES_DEPTH + 1];
-    init_offsets(virtualAddress, offsets);
+    *table = entry->table;
+    return true;
+}
 
-    uint64_t physical_address = find_physical_address(virtualAddress, offsets);
-    PMread(physical_address * PAGE_SIZE + offsets[TABLES_DEPTH], value);
 
+/**
+ * Caches the last level table of a page
+ *
+ * @param pageNumber The virtual page number
+ * @param table The frame of the last level table
+ */
+void record_walk_cache(uint64_t pageNumber, word_t table) {
+    uint64_t prefix = pageNumber >> OFFSET_WIDTH;
+    walkCache[prefix % VM_WALK_CACHE_ENTRIES] = {prefix, table, frameVersions[table]};
+}
+
+
+/**
+ * Empties the translation cache
+ */
+void clear_extents() {
+    for (int i = 0; i < VM_TLB_EXTENTS; i++) {
+        cachedExtents[i] = {0, 0, 0};
+    }
+    nextExtent = 0;
+}
+
+
+#ifdef VM_ADMISSION_FILTER
+/**
+ * Hashes a page to its counter in the given row of the sketch
+ *
+ * @param pageNumber The virtual page number
+ * @param row The row of the sketch
+ * @return The index of the counter in the row
+ */
+uint64_t sketch_index(uint64_t pageNumber, int row) {
+    uint64_t hash = (pageNumber + 1) * SKETCH_SEEDS[row];
+    return (hash ^ (hash >> 32)) % VM_SKETCH_WIDTH;
+}
+
+
+/**
+ * Counts an access to the given page in the sketch
+ *
+ * @param pageNumber The virtual page number
+ */
+void sketch_add(uint64_t pageNumber) {
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        uint8_t* counter = &sketch[row][sketch_index(pageNumber, row)];
+        if (*counter < UINT8_MAX) {
+            (*counter)++;
+        }
+    }
+
+    // aging - halve all the counters so old accesses count less than new ones
+    if (++sketchAdditions == 10 * VM_SKETCH_WIDTH) {
+        sketchAdditions = 0;
+        for (int row = 0; row < SKETCH_DEPTH; row++) {
+            for (uint64_t i = 0; i < VM_SKETCH_WIDTH; i++) {
+                sketch[row][i] >>= 1;
+            }
+        }
+    }
+}
+
+
+/**
+ * Estimates the access frequency of the given page - the minimal counter over the rows
+ *
+ * @param pageNumber The virtual page number
+ * @return The estimated number of recent accesses to the page
+ */
+uint8_t sketch_estimate(uint64_t pageNumber) {
+    uint8_t estimate = UINT8_MAX;
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        uint8_t counter = sketch[row][sketch_index(pageNumber, row)];
+        if (counter < estimate) {
+            estimate = counter;
+        }
+    }
+    return estimate;
+}
+#endif
+
+
+/**
+ * Adds a frame that now holds a page to the resident pages
+ *
+ * @param frame The frame of the page
+ */
+void add_resident(word_t frame) {
+    frames[frame].residentSlot = residentCount;
+    frames[frame].lastAccess = accessClock;
+    frames[frame].accessCount = 0;
+    residentFrames[residentCount++] = frame;
+}
+
+
+/**
+ * Removes a frame whose page was evicted from the resident pages
+ *
+ * @param frame The frame of the page
+ */
+void remove_resident(word_t frame) {
+    uint64_t slot = frames[frame].residentSlot;
+    word_t last = residentFrames[--residentCount];
+    residentFrames[slot] = last;
+    frames[last].residentSlot = slot;
+}
+
+
+/**
+ * Adds the given changes to the summary of a table and of all the tables above it
+ *
+ * @param frame The frame of the table
+ * @param emptyTablesDelta The change in the number of empty tables in the subtree
+ * @param pagesDelta The change in the number of pages in the subtree
+ */
+void update_summaries(word_t frame, int64_t emptyTablesDelta, int64_t pagesDelta) {
+    while (true) {
+        frames[frame].emptyTablesBelow += emptyTablesDelta;
+        frames[frame].pagesBelow += pagesDelta;
+
+        if (frame == 0) {
+            return;
+        }
+        frame = (word_t) (frames[frame].parentEntry / PAGE_SIZE);
+    }
+}
+
+
+/**
+ * Updates the summaries after a frame was linked to a table
+ *
+ * @param table The frame of the table
+ * @param child The frame that was linked to it
+ */
+void link_summaries(word_t table, word_t child) {
+    bool wasEmpty = table != 0 && frames[table].children == 0;
+    frames[table].children++;
+
+    update_summaries(table, (int64_t) frames[child].emptyTablesBelow - (wasEmpty ? 1 : 0),
+                     (int64_t) frames[child].pagesBelow);
+}
+
+
+/**
+ * Updates the summaries after a frame was unlinked from a table
+ *
+ * @param table The frame of the table
+ * @param child The frame that was unlinked from it
+ */
+void unlink_summaries(word_t table, word_t child) {
+    frames[table].children--;
+    bool isEmpty = table != 0 && frames[table].children == 0;
+
+    update_summaries(table, (isEmpty ? 1 : 0) - (int64_t) frames[child].emptyTablesBelow,
+                     -(int64_t) frames[child].pagesBelow);
+}
+
+
+/**
+ * Moves a table entry address along with the frame contents it lives in, when the frames a and b
+ * swap their contents
+ *
+ * @param entry The physical address of the table entry
+ * @param a The first swapped frame
+ * @param b The second swapped frame
+ * @return The physical address of the entry after the swap
+ */
+uint64_t relocate_entry(uint64_t entry, word_t a, word_t b) {
+    if (entry / PAGE_SIZE == (uint64_t) a) {
+        return entry - a * PAGE_SIZE + b * PAGE_SIZE;
+    }
+    if (entry / PAGE_SIZE == (uint64_t) b) {
+        return entry - b * PAGE_SIZE + a * PAGE_SIZE;
+    }
+    return entry;
+}
+
+
+/**
+ * Points the reverse map of the children of a table at the table's (new) frame
+ *
+ * @param tableFrame The frame that holds the table
+ */
+void relink_children(word_t tableFrame) {
+    for (int i = 0; i < PAGE_SIZE; i++) {
+        word_t child = read_entry(tableFrame * PAGE_SIZE + i);
+
+        if (child != 0) {
+            frames[child].parentEntry = tableFrame * PAGE_SIZE + i;
+        }
+    }
+}
+
+
+/**
+ * Swaps the contents of two frames in use (tables or pages) and fixes the entries that point to
+ * them, so the tree of tables maps exactly the same pages afterwards
+ *
+ * @param a The first frame (not the root)
+ * @param b The second frame (not the root)
+ */
+void swap_frames(word_t a, word_t b) {
+    uint64_t parentOfA = frames[a].parentEntry;
+    uint64_t parentOfB = frames[b].parentEntry;
+
+    for (int i = 0; i < PAGE_SIZE; i++) {
+        word_t valueA;
+        word_t valueB;
+        PMread(a * PAGE_SIZE + i, &valueA);
+        PMread(b * PAGE_SIZE + i, &valueB);
+        PMwrite(a * PAGE_SIZE + i, valueB);
+        PMwrite(b * PAGE_SIZE + i, valueA);
+    }
+
+    // one frame may be the parent of the other - its entry moved together with its contents
+    parentOfA = relocate_entry(parentOfA, a, b);
+    parentOfB = relocate_entry(parentOfB, a, b);
+    write_entry(parentOfA, b);
+    write_entry(parentOfB, a);
+
+    // the frames hold other tables or pages now
+    frameVersions[a]++;
+    frameVersions[b]++;
+
+    FrameInfo infoOfA = frames[a];
+    frames[a] = frames[b];
+    frames[b] = infoOfA;
+    frames[a].parentEntry = parentOfB;
+    frames[b].parentEntry = parentOfA;
+
+    if (frames[a].isLeaf) {
+        residentFrames[frames[a].residentSlot] = a;
+    }
+    if (frames[b].isLeaf) {
+        residentFrames[frames[b].residentSlot] = b;
+    }
+
+    if (!frames[a].isLeaf) {
+        relink_children(a);
+    }
+    if (!frames[b].isLeaf) {
+        relink_children(b);
+    }
+}
+
+
+/**
+ * Returns the tier of a frame - 0 for the fast tier, 1 for the slow tier (VM_FAST_FRAMES)
+ *
+ * @param frame The frame
+ * @return The tier of the frame
+ */
+uint64_t tier_of(uint64_t frame) {
+#ifdef VM_FAST_FRAMES
+    return frame < VM_FAST_FRAMES ? 0 : 1;
+#else
+    (void) frame;
+    return 0;
+#endif
+}
+
+
+#ifdef VM_FAST_FRAMES
+/**
+ * Finds the page of a tier that was accessed least recently and may be moved
+ *
+ * @param tier The tier
+ * @param args Arguments of the search for a victim - the page must be in a quota class at least
+ *             as high as the victim's (nullptr for no limit)
+ * @return The frame of the page, or 0 if there is none
+ */
+word_t coldest_page(uint64_t tier, SearchArguments* args) {
+    word_t coldest = 0;
+
+    for (uint64_t i = 0; i < residentCount; i++) {
+        word_t frame = residentFrames[i];
+
+        if (tier_of(frame) != tier || is_hazard(frame) ||
+            (args != nullptr && quota_class(args, frames[frame].page) < args->maxCyclicClass)) {
+            continue;
+        }
+        if (coldest == 0 || frames[frame].lastAccess < frames[coldest].lastAccess) {
+            coldest = frame;
+        }
+    }
+
+    return coldest;
+}
+
+
+/**
+ * Exchanges the frames of two pages in different tiers
+ *
+ * @param a The frame of the first page
+ * @param b The frame of the second page
+ */
+void exchange_pages(word_t a, word_t b) {
+    invalidate_extent(frames[a].page);
+    invalidate_extent(frames[b].page);
+    mappingEpoch++;
+    swap_frames(a, b);
+
+    // promotion counts the accesses since the page entered the slow tier
+    frames[a].accessCount = 0;
+    frames[b].accessCount = 0;
+    tierStats[tier_of(a)].pagesIn++;
+    tierStats[tier_of(b)].pagesIn++;
+}
+#endif
+
+
+/**
+ * Moves a page of the slow tier that is accessed repeatedly to the fast tier, in place of the
+ * page of the fast tier that was accessed least recently (VM_FAST_FRAMES)
+ *
+ * @param frame The frame of the page that was accessed
+ * @return The frame of the page afterwards
+ */
+uint64_t promote_page(uint64_t frame) {
+#ifdef VM_FAST_FRAMES
+    if (tier_of(frame) == 1 && frames[frame].accessCount >= VM_PROMOTE_ACCESSES &&
+        !is_hazard((word_t) frame)) {
+        word_t coldest = coldest_page(0, nullptr);
+
+        if (coldest != 0) {
+            exchange_pages((word_t) frame, coldest);
+            return coldest;
+        }
+    }
+#endif
+    return frame;
+}
+
+
+/**
+ * Checks whether a page has a copy in the swap
+ *
+ * @param pageNumber The virtual page number
+ * @return True if the page was evicted and was not restored since
+ */
+bool is_swapped(uint64_t pageNumber) {
+    return (swappedPages[pageNumber / 64] >> (pageNumber % 64)) & 1;
+}
+
+
+/**
+ * Moves a page from a frame to the swap
+ *
+ * @param frame The frame of the page
+ * @param pageNumber The virtual page number
+ */
+void evict_page(uint64_t frame, uint64_t pageNumber) {
+    PMevict(frame, pageNumber);
+    swappedPages[pageNumber / 64] |= (uint64_t) 1 << (pageNumber % 64);
+}
+
+
+/**
+ * Moves a page from the swap to a frame (the frame keeps its contents if the page has no copy in
+ * the swap)
+ *
+ * @param frame The frame of the page
+ * @param pageNumber The virtual page number
+ */
+void restore_page(uint64_t frame, uint64_t pageNumber) {
+    PMrestore(frame, pageNumber);
+    swappedPages[pageNumber / 64] &= ~((uint64_t) 1 << (pageNumber % 64));
+}
+
+
+/**
+ * Handles the case an empty frame was not founds and checks for the other priorities - an unused
+ * frame or eviction of a frame
+ * 
+ * @param args Arguments provided for the DFS
+ */
+void empty_frame_not_found(SearchArguments* args) {
+    // check if there is an unused frame
+    if (has_unused_frame(args)) {
+        args->priority = 2;
+        return;
+    }
+
+    // no page may be evicted - they are pinned, or the region of the page is at its maximum and
+    // none of its pages can go. The page is served from the bounce frame, or cannot be mapped
+    if (!has_valid_victim(args)) {
+        args->priority = 0;
+        return;
+    }
+
+#ifdef VM_ADMISSION_FILTER
+    // the page swapped in is not more popular than the victim - keep the victim in the memory and
+    // serve the page from the bounce frame
+    if (sketch_estimate(args->pageNumber) <= sketch_estimate(args->maxCyclicPage)) {
+        args->priority = 0;
+        return;
+    }
+#endif
+
+#ifdef VM_FAST_FRAMES
+    // a page of the fast tier is demoted to the slow tier first - the coldest page of the slow tier
+    // is evicted in its place, and the page swapped in gets the fast frame
+    if (tier_of(args->maxCyclicFrame) == 0) {
+        word_t coldest = coldest_page(1, args);
+
+        if (coldest != 0) {
+            exchange_pages(args->maxCyclicFrame, coldest);
+            args->maxCyclicPage = frames[args->maxCyclicFrame].page;
+            args->maxCyclicParent = frames[args->maxCyclicFrame].parentEntry;
+        }
+    }
+#endif
+
+    // no available frames - need to evict
+    stats.evictions++;
+    stats.victimDistanceSum += args->maxCyclicDist;
+    regions[region_of(args->maxCyclicPage)].stats.frames--;
+    regions[region_of(args->maxCyclicPage)].stats.evictions++;
+    mappingEpoch++;
+    invalidate_extent(args->maxCyclicPage);
+    PMwrite(args->maxCyclicParent, 0);
+    unlink_summaries((word_t) (args->maxCyclicParent / PAGE_SIZE), args->maxCyclicFrame);
+
+    // a clean page is filled with zeros again when it is mapped - no need to write it
+    if (frames[args->maxCyclicFrame].clean) {
+        stats.cleanDrops++;
+    }
+    else {
+        evict_page(args->maxCyclicFrame, args->maxCyclicPage);
+    }
+    remove_resident(args->maxCyclicFrame);
+    args->priority = 3;
+}
+
+
+/**
+ * Checks whether the table stored in the given frame has no entries
+ *
+ * @param frame The frame of the table
+ * @return True if all the entries of the table are zero
+ */
+bool is_table_empty(word_t frame) {
+    return frames[frame].children == 0;
+}
+
+
+/**
+ * Calculates the maximal cyclic distance between a page and any page in a range of pages
+ *
+ * @param pageNumber The page we want to swap in
+ * @param first The first page of the range
+ * @param last The last page of the range
+ * @return The maximal cyclic distance
+ */
+int max_cyclic_distance(uint64_t pageNumber, uint64_t first, uint64_t last) {
+    // the distance grows up to the opposite page on the cycle, so without it in the range the
+    // farthest page is one of the ends
+    uint64_t opposite = (pageNumber + NUM_PAGES / 2) % NUM_PAGES;
+    if (first <= opposite && opposite <= last) {
+        return cyclic_distance(pageNumber, opposite);
+    }
+
+    int firstDist = cyclic_distance(pageNumber, first);
+    int lastDist = cyclic_distance(pageNumber, last);
+    return firstDist > lastDist ? firstDist : lastDist;
+}
+
+
+/**
+ * Checks whether the search can skip the subtree of a frame - it has no empty table and none of
+ * its pages can replace the page with the maximal cyclic distance found so far
+ *
+ * @param args Arguments provided for the DFS
+ * @param frame The root frame of the subtree
+ * @param virtualPrefix The virtual address of the root frame of the subtree
+ * @param depth The depth of the root frame of the subtree
+ * @return True if the subtree does not need to be searched
+ */
+bool can_skip_subtree(SearchArguments* args, word_t frame, uint64_t virtualPrefix,
+                      uint64_t depth) {
+    if (frames[frame].emptyTablesBelow != 0) {
+        return false;
+    }
+
+    int boundClass = args->maxCyclicClass;
+    int boundDist = args->maxCyclicDist;
+#ifdef VM_SEARCH_THREADS
+    // another worker may have found a better page already
+    uint64_t shared = searchBound.load(std::memory_order_relaxed);
+    if (shared > pack_bound(boundClass, boundDist)) {
+        boundClass = (int) (shared >> 32);
+        boundDist = (int) (shared & UINT32_MAX);
+    }
+#endif
+
+    int subtreeClass = quota_class(args, frames[frame].page);
+    if (subtreeClass != boundClass) {
+        return subtreeClass < boundClass;
+    }
+
+    // ties go to the later page, so the subtree is skipped only if it cannot reach the distance
+    uint64_t shift = OFFSET_WIDTH * (TABLES_DEPTH - depth);
+    uint64_t first = virtualPrefix << shift;
+    uint64_t last = ((virtualPrefix + 1) << shift) - 1;
+    return max_cyclic_distance(args->pageNumber, first, last) < boundDist;
+}
+
+
+/**
+ * Checks whether the tree has an empty table the search could reuse
+ *
+ * @param args Arguments provided for the search
+ * @return True if there is an empty table other than the current frame
+ */
+bool has_empty_table(SearchArguments* args) {
+    uint64_t emptyTables = frames[0].emptyTablesBelow;
+    if (args->currentFrame != 0 && is_table_empty(args->currentFrame)) {
+        emptyTables--;
+    }
+    return emptyTables > 0;
+}
+
+
+/**
+ * Checks whether a frame is in the subtree of another frame
+ *
+ * @param frame The frame
+ * @param root The root frame of the subtree
+ * @return True if root is the frame or one of the tables above it
+ */
+bool is_in_subtree(word_t frame, word_t root) {
+    while (frame != root) {
+        if (frame == 0) {
+            return false;
+        }
+        frame = (word_t) (frames[frame].parentEntry / PAGE_SIZE);
+    }
+    return true;
+}
+
+
+/**
+ * Counts the empty tables in the subtree of a frame, leaving out the given table
+ *
+ * @param frame The root frame of the subtree
+ * @param excluded A table that is not counted (0 for none)
+ * @return The number of empty tables
+ */
+uint64_t count_empty_tables(word_t frame, word_t excluded) {
+    uint64_t count = frames[frame].emptyTablesBelow;
+    if (excluded != 0 && is_table_empty(excluded) && is_in_subtree(excluded, frame)) {
+        count--;
+    }
+    return count;
+}
+
+
+/**
+ * Finds an empty table (not the root) by following the subtrees that have one
+ *
+ * @param excluded A table that must not be returned (0 for none)
+ * @param parentEntry Output - the physical address of the entry that points to the empty table
+ * @return The frame of the empty table, or 0 if there is none
+ */
+word_t find_empty_table(word_t excluded, uint64_t* parentEntry) {
+    word_t frame = 0;
+    if (count_empty_tables(frame, excluded) == 0) {
+        return 0;
+    }
+
+    while (frame == 0 || !is_table_empty(frame)) {
+        for (uint64_t i = 0; i < PAGE_SIZE; i++) {
+            word_t child = read_entry(frame * PAGE_SIZE + i);
+
+            if (child != 0 && count_empty_tables(child, excluded) != 0) {
+                *parentEntry = frame * PAGE_SIZE + i;
+                frame = child;
+                break;
+            }
+        }
+    }
+    return frame;
+}
+
+
+/**
+ * Choose the frame by traversing the entire tree of tables in the physical memory while looking
+ * for one of the following (prioritized):
+ * (1) Frame with an empty table
+ * (2) Unused frame
+ * (3) Evict the frame that contains a page with the maximal cyclical distance
+ *
+ * An empty table that was found is not unlinked here - its parent entry is kept in the arguments
+ * and the caller unlinks it. The summaries of the tables let the search skip subtrees that hold
+ * neither an empty table nor a better page, and skip the search altogether when no table can be
+ * reused and there is an unused frame.
+ *
+ * @param args Arguments provided for the DFS
+ * @param rootFrame The root frame of the current recursion level
+ * @param currentVirtual The virtual address of the root frame
+ * @param parent The parent of the current root frame (in the tree)
+ * @param depth The current depth we have reached so far in the tree
+ * @param offset The last frame's offset
+ */
+void find_next_frame(SearchArguments* args, word_t rootFrame, uint64_t currentVirtual,
+                    uint64_t parent, uint64_t depth, uint64_t offset) {
+    args->framesScanned++;
+
+    // nothing to search for - the unused frame is taken
+    if (rootFrame == 0 && !has_empty_table(args) && has_unused_frame(args)) {
+        empty_frame_not_found(args);
+        return;
+    }
+
+    // reached the leaves - need to calculate the cyclic distance and update
+    if (depth == TABLES_DEPTH) {
+        update_max_cyclic_distance(args, rootFrame, currentVirtual, parent, offset);
+        return;
+    }
+
+    // check the current root frame is empty & valid for being the next frame
+    if (rootFrame != 0 && rootFrame != args->currentFrame && may_reuse_table(args, rootFrame) &&
+        is_table_empty(rootFrame)) {
+        args->emptyFrame = rootFrame;
+        args->emptyParent = parent * PAGE_SIZE + offset;
+        args->priority = 1;
+        return;
+    }
+
+    // search for empty/unused frames
+    word_t nextFrame = 0;
+
+    for (int i = 0; i < PAGE_SIZE; i++) {
+        nextFrame = read_entry(rootFrame * PAGE_SIZE + i);
+
+        // there is a next frame in the path (the current frame is not empty)
+        if (nextFrame != 0) {
+            if (nextFrame >= args->maxFrame) {
+                args->maxFrame = nextFrame;
+            }
+
+            uint64_t childVirtual = (currentVirtual << OFFSET_WIDTH) + i;
+            if (can_skip_subtree(args, nextFrame, childVirtual, depth + 1)) {
+                continue;
+            }
+
+            find_next_frame(args, nextFrame, childVirtual, rootFrame,
+                            depth + 1, i);
+
+            // an empty frame was found during the DFS search
+            if (args->priority == 1) {
+                return;
+            }
+        }
+    }
+
+    // finished the recursive search for empty frame and reached the original root frame
+    if (rootFrame == 0) {
+        empty_frame_not_found(args);
+        return;
+    }
+}
+
+
+#ifdef VM_SEARCH_THREADS
+/**
+ * The workers of the parallel victim search - started by the first parallel search and kept
+ * waiting for the next one, so a fault does not pay for starting threads
+ */
+struct SearchPool {
+    std::thread workers[VM_SEARCH_THREADS - 1];
+    bool started = false;
+    std::mutex lock;
+    std::condition_variable posted;  // a search was posted, or the pool is stopping
+    std::condition_variable finished;  // the workers finished the posted search
+    uint64_t generation = 0;  // the number of searches posted so far
+    int searching = 0;  // the workers that have not finished the posted search yet
+    bool stopping = false;
+    std::atomic<int> nextSubtree{0};  // the next subtree of the root to search
+    const word_t* children = nullptr;  // the subtrees of the root (0 if the entry is empty)
+    SearchArguments* results = nullptr;  // the result of the search of every subtree
+
+    ~SearchPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        posted.notify_all();
+
+        for (int w = 0; started && w < VM_SEARCH_THREADS - 1; w++) {
+            workers[w].join();
+        }
+    }
+};
+
+SearchPool searchPool;
+
+
+/**
+ * Searches the subtrees of the posted search until none is left - the subtrees are taken one at a
+ * time, so a worker that drew small subtrees takes more of them
+ *
+ * @param pool The pool
+ */
+void search_subtrees(SearchPool* pool) {
+    for (int i = pool->nextSubtree++; i < PAGE_SIZE; i = pool->nextSubtree++) {
+        if (pool->children[i] != 0) {
+            find_next_frame(&pool->results[i], pool->children[i], i, 0, 1, i);
+        }
+    }
+}
+
+
+/**
+ * The loop of a worker - waits for a search to be posted, takes part in it and reports when done
+ *
+ * @param pool The pool
+ */
+void search_worker(SearchPool* pool) {
+    uint64_t done = 0;
+    std::unique_lock<std::mutex> guard(pool->lock);
+
+    while (true) {
+        pool->posted.wait(guard, [pool, done] {
+            return pool->stopping || pool->generation != done;
+        });
+        if (pool->stopping) {
+            return;
+        }
+
+        done = pool->generation;
+        guard.unlock();
+        search_subtrees(pool);
+        guard.lock();
+
+        if (--pool->searching == 0) {
+            pool->finished.notify_one();
+        }
+    }
+}
+
+
+/**
+ * Parallel version of find_next_frame - the subtrees of the root are searched with
+ * find_next_frame (which only reads the tables) by the faulting thread and VM_SEARCH_THREADS - 1
+ * workers of a pool, and the results are merged in the order of the subtrees. The first empty
+ * table by that order wins, and otherwise the page with the maximal cyclic distance wins with the
+ * same tie-break as update_max_cyclic_distance, so the result is exactly the one of the sequential
+ * search. The workers share the best victim found so far, and a subtree is skipped only if it
+ * cannot reach it, so the pruning does not change the result either.
+ *
+ * @param args Arguments provided for the search
+ */
+void find_next_frame_parallel(SearchArguments* args) {
+    searchBound.store(0, std::memory_order_relaxed);
+
+    if (usedFrames < VM_PARALLEL_MIN_FRAMES) {
+        find_next_frame(args, 0, 0, 0, 0, 0);
+        return;
+    }
+
+    // nothing to search for - the unused frame is taken
+    if (!has_empty_table(args) && has_unused_frame(args)) {
+        empty_frame_not_found(args);
+        return;
+    }
+
+    SearchArguments results[PAGE_SIZE];
+    word_t children[PAGE_SIZE];
+
+    for (int i = 0; i < PAGE_SIZE; i++) {
+        children[i] = read_entry(i);
+        results[i] = *args;
+        results[i].framesScanned = 0;
+    }
+
+    SearchPool* pool = &searchPool;
+    if (!pool->started) {
+        for (int w = 0; w < VM_SEARCH_THREADS - 1; w++) {
+            pool->workers[w] = std::thread(search_worker, pool);
+        }
+        pool->started = true;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->children = children;
+        pool->results = results;
+        pool->nextSubtree = 0;
+        pool->searching = VM_SEARCH_THREADS - 1;
+        pool->generation++;
+    }
+    pool->posted.notify_all();
+
+    search_subtrees(pool);
+    {
+        std::unique_lock<std::mutex> guard(pool->lock);
+        pool->finished.wait(guard, [pool] { return pool->searching == 0; });
+    }
+
+    args->framesScanned++;  // the root
+    for (int i = 0; i < PAGE_SIZE; i++) {
+        args->framesScanned += results[i].framesScanned;
+    }
+
+    for (int i = 0; i < PAGE_SIZE; i++) {
+        SearchArguments* result = &results[i];
+
+        if (result->priority == 1) {
+            args->emptyFrame = result->emptyFrame;
+            args->emptyParent = result->emptyParent;
+            args->priority = 1;
+            return;
+        }
+
+        if (result->maxCyclicFrame != 0 &&
+            (result->maxCyclicClass > args->maxCyclicClass ||
+             (result->maxCyclicClass == args->maxCyclicClass &&
+              result->maxCyclicDist >= args->maxCyclicDist))) {
+            args->maxCyclicClass = result->maxCyclicClass;
+            args->maxCyclicFrame = result->maxCyclicFrame;
+            args->maxCyclicDist = result->maxCyclicDist;
+            args->maxCyclicPage = result->maxCyclicPage;
+            args->maxCyclicParent = result->maxCyclicParent;
+        }
+    }
+
+    empty_frame_not_found(args);
+}
+#endif
+
+
+#ifdef VM_VICTIM_SEARCH_BUDGET
+/**
+ * Bounded version of find_next_frame - examines VM_VICTIM_SEARCH_BUDGET frames through the
+ * reverse map, resuming where the previous search stopped, so the cost of a fault does not grow
+ * with the size of the tree. The evicted page is the one with the maximal cyclic distance among
+ * the pages that were examined. When the memory is full the search goes on past the budget until
+ * it has seen a page it may evict, so there is always a page to evict.
+ *
+ * @param args Arguments provided for the search
+ */
+void find_next_frame_bounded(SearchArguments* args) {
+    uint64_t candidates = usedFrames - 1;  // every frame in use except the root
+
+    for (uint64_t k = 0; k < candidates; k++) {
+        if (k >= VM_VICTIM_SEARCH_BUDGET &&
+            (has_valid_victim(args) || has_unused_frame(args))) {
+            break;
+        }
+
+        word_t frame = (word_t) (1 + searchCursor % candidates);
+        searchCursor++;
+        args->framesScanned++;
+
+        if (frames[frame].isLeaf) {
+            uint64_t parentEntry = frames[frame].parentEntry;
+            update_max_cyclic_distance(args, frame, frames[frame].page, parentEntry / PAGE_SIZE,
+                                       parentEntry % PAGE_SIZE);
+        }
+
+        // an empty table that is not the one we are about to fill
+        else if (frame != args->currentFrame && may_reuse_table(args, frame) &&
+                 is_table_empty(frame)) {
+            args->emptyFrame = frame;
+            args->emptyParent = frames[frame].parentEntry;
+            args->priority = 1;
+            return;
+        }
+    }
+
+    empty_frame_not_found(args);
+}
+#endif
+
+
+#ifdef VM_EVICTION_SAMPLES
+/**
+ * Remembers a table that may have no entries left, so the next search can reuse it - the table is
+ * checked again before it is reused
+ *
+ * @param frame The frame of the table (the root is never reused)
+ */
+void remember_empty_table(word_t frame) {
+    if (frame != 0 && emptyTablesCount < NUM_FRAMES) {
+        emptyTables[emptyTablesCount++] = frame;
+    }
+}
+
+
+/**
+ * Scores a resident page as a victim under VM_EVICTION_SCORE - the higher, the better the victim
+ *
+ * @param args Arguments provided for the search
+ * @param frame The frame of the page
+ * @return The score of the page
+ */
+uint64_t victim_score(SearchArguments* args, word_t frame) {
+#if VM_EVICTION_SCORE == VM_SCORE_LRU
+    (void) args;
+    return accessClock - frames[frame].lastAccess;
+#elif VM_EVICTION_SCORE == VM_SCORE_LFU
+    (void) args;
+    return UINT64_MAX - frames[frame].accessCount;
+#else
+    return cyclic_distance(args->pageNumber, frames[frame].page);
+#endif
+}
+
+
+/**
+ * Chooses a resident page as the victim of the sampled search
+ *
+ * @param args Arguments provided for the search
+ * @param frame The frame of the page
+ * @param victimClass The quota class of the page
+ */
+void set_sampled_victim(SearchArguments* args, word_t frame, int victimClass) {
+    args->maxCyclicClass = victimClass;
+    args->maxCyclicFrame = frame;
+    args->maxCyclicDist = cyclic_distance(args->pageNumber, frames[frame].page);
+    args->maxCyclicPage = frames[frame].page;
+    args->maxCyclicParent = frames[frame].parentEntry;
+}
+
+
+/**
+ * Sampled version of find_next_frame - the cost of a fault is O(VM_EVICTION_SAMPLES) regardless
+ * of the size of the memory:
+ * (1) A table that a previous eviction left empty
+ * (2) Unused frame
+ * (3) Evict the best scored page out of VM_EVICTION_SAMPLES random resident pages
+ *
+ * @param args Arguments provided for the search
+ */
+void find_next_frame_sampled(SearchArguments* args) {
+    while (emptyTablesCount > 0) {
+        word_t table = emptyTables[--emptyTablesCount];
+
+        // the table may have been reused or filled since it was remembered
+        if (table != args->currentFrame && table < usedFrames && !frames[table].isLeaf &&
+            may_reuse_table(args, table) && is_table_empty(table)) {
+            args->emptyFrame = table;
+            args->emptyParent = frames[table].parentEntry;
+            remember_empty_table((word_t) (frames[table].parentEntry / PAGE_SIZE));
+            args->priority = 1;
+            return;
+        }
+    }
+
+    // an empty table that was not remembered (left by a page that was not admitted, or by a table
+    // whose pages were all evicted) - the summaries lead straight to it
+    uint64_t parentEntry;
+    word_t table = find_empty_table(args->currentFrame, &parentEntry);
+    if (table != 0 && may_reuse_table(args, table)) {
+        args->emptyFrame = table;
+        args->emptyParent = parentEntry;
+        args->priority = 1;
+        return;
+    }
+
+    // with no resident page there is nothing to sample
+    if (!has_unused_frame(args) && residentCount > 0) {
+        uint64_t bestScore = 0;
+
+        for (int i = 0; i < VM_EVICTION_SAMPLES; i++) {
+            sampleSeed ^= sampleSeed << 13;
+            sampleSeed ^= sampleSeed >> 7;
+            sampleSeed ^= sampleSeed << 17;
+
+            word_t frame = residentFrames[sampleSeed % residentCount];
+            args->framesScanned++;
+
+            if (is_hazard(frame)) {
+                continue;
+            }
+
+            uint64_t score = victim_score(args, frame);
+            int victimClass = quota_class(args, frames[frame].page);
+            if (args->maxCyclicFrame == 0 || victimClass > args->maxCyclicClass ||
+                (victimClass == args->maxCyclicClass && score > bestScore)) {
+                bestScore = score;
+                set_sampled_victim(args, frame, victimClass);
+            }
+        }
+
+        // only pinned pages were sampled, or the region of the page is at its maximum and none
+        // of its pages was sampled
+        for (uint64_t slot = 0; slot < residentCount && !has_valid_victim(args); slot++) {
+            word_t frame = residentFrames[slot];
+            int victimClass = quota_class(args, frames[frame].page);
+
+            if (!is_hazard(frame) && (victimClass == 3 || !region_at_max(args->pageNumber))) {
+                set_sampled_victim(args, frame, victimClass);
+            }
+        }
+    }
+
+    empty_frame_not_found(args);
+
+    // the evicted page may have been the last one in its table
+    if (args->priority == 3) {
+        remember_empty_table((word_t) (args->maxCyclicParent / PAGE_SIZE));
+    }
+}
+#endif
+
+
+
+
+/**
+ * Finishes an access to a page - a page that was served through the bounce frame goes back to the
+ * swap right away if it has contents to keep, so the frame is ready for the next page that is not
+ * admitted
+ *
+ * @param frame The frame the page was accessed in
+ * @param pageNumber The virtual page number
+ */
+void release_frame(uint64_t frame, uint64_t pageNumber) {
+#ifdef BOUNCE_FRAME
+    if (frame == BOUNCE_FRAME && bounceDirty) {
+        evict_page(frame, pageNumber);
+        bounceDirty = false;
+    }
+#else
+    (void) frame;
+    (void) pageNumber;
+#endif
+}
+
+
+/**
+ * Records a write to the page stored in the given frame
+ *
+ * @param frame The frame of the page
+ */
+void record_write(uint64_t frame) {
+#ifdef BOUNCE_FRAME
+    // the page is not mapped - it goes back to the swap when it is released
+    if (frame == BOUNCE_FRAME) {
+        bounceDirty = true;
+        return;
+    }
+#endif
+    frames[frame].clean = false;
+}
+
+
+/**
+ * Records an access to the page stored in the given frame
+ *
+ * @param frame The frame of the page
+ */
+void touch_frame(word_t frame) {
+    frames[frame].lastAccess = ++accessClock;
+    frames[frame].accessCount++;
+    tierStats[tier_of(frame)].accesses++;
+}
+
+
+/**
+ * Unlinks an empty table from its parent, so its frame can be reused
+ *
+ * @param frame The frame of the table
+ * @param parentEntry The physical address of the entry that points to it
+ */
+void unlink_table(word_t frame, uint64_t parentEntry) {
+    PMwrite(parentEntry, 0);
+    unlink_summaries((word_t) (parentEntry / PAGE_SIZE), frame);
+    regions[region_of(frames[frame].page)].stats.frames--;
+}
+
+
+/**
+ * Links a frame to an entry of a table and records it in the frame table
+ *
+ * @param table The frame of the table
+ * @param offset The offset of the entry in the table
+ * @param frame The frame to link
+ * @param pageNumber The virtual page number the frame is linked for
+ * @param isLeaf Whether the frame holds the page (and not a table)
+ */
+void link_frame(word_t table, uint64_t offset, word_t frame, uint64_t pageNumber, bool isLeaf) {
+    write_entry(table * PAGE_SIZE + offset, frame);
+    frameVersions[frame]++;
+    frames[frame].parentEntry = table * PAGE_SIZE + offset;
+    frames[frame].page = pageNumber;
+    frames[frame].isLeaf = isLeaf;
+    frames[frame].children = 0;
+    frames[frame].emptyTablesBelow = isLeaf ? 0 : 1;
+    frames[frame].pagesBelow = isLeaf ? 1 : 0;
+    link_summaries(table, frame);
+    regions[region_of(pageNumber)].stats.frames++;
+    if (frame >= usedFrames) {
+        usedFrames = frame + 1;
+    }
+    if (isLeaf) {
+        add_resident(frame);
+    }
+}
+
+
+/**
+ * Brings the contents of a page into the frame it was just mapped to
+ *
+ * @param frame The frame of the page
+ * @param pageNumber The virtual page number
+ * @return True if the page was restored from the swap
+ */
+bool load_page(word_t frame, uint64_t pageNumber) {
+    bool swapped = is_swapped(pageNumber);
+    frames[frame].clean = false;
+
+#if defined(VM_DROP_CLEAN_PAGES) || defined(BOUNCE_FRAME)
+    // a page that was never evicted has no contents yet - fill it with zeros, so it does not have
+    // to be written to the swap until it is written to (a page read through the bounce frame is
+    // not written to the swap, and reads the same zeros once it is mapped)
+    if (!swapped) {
+        for (int i = 0; i < PAGE_SIZE; i++) {
+            PMwrite(frame * PAGE_SIZE + i, 0);
+        }
+#ifdef VM_DROP_CLEAN_PAGES
+        frames[frame].clean = true;
+#endif
+        return false;
+    }
+#endif
+
+    restore_page(frame, pageNumber);
+    return swapped;
+}
+
+
+#ifdef VM_SWAP_READAHEAD
+/**
+ * Restores the pages that follow a page restored from the swap, while they are in the swap and
+ * there are frames that are not in use or empty tables to take. Only pages of the same last level
+ * table are restored, so no table has to be mapped, and no page is evicted for them.
+ *
+ * @param table The frame of the last level table of the page
+ * @param pageNumber The virtual page number that was restored
+ */
+void read_ahead(word_t table, uint64_t pageNumber) {
+    uint64_t lastPage = pageNumber | (PAGE_SIZE - 1);
+
+    for (uint64_t page = pageNumber + 1;
+         page <= lastPage && page < NUM_PAGES && page <= pageNumber + VM_SWAP_READAHEAD; page++) {
+        if (!is_swapped(page)) {
+            break;
+        }
+        if (region_at_max(page)) {
+            return;
+        }
+
+        word_t frame = usedFrames;
+        if (frame >= USABLE_FRAMES) {
+            uint64_t parentEntry;
+            frame = find_empty_table(0, &parentEntry);
+            if (frame == 0) {
+                return;
+            }
+            unlink_table(frame, parentEntry);
+        }
+
+        link_frame(table, page & (PAGE_SIZE - 1), frame, page, true);
+        load_page(frame, page);
+        record_extent(page, frame);
+        stats.readAhead++;
+    }
+}
+#endif
+
+
+/**
+ * Finds the physical address of a given virtual address
+ *
+ * @param virtualAddress The virtual address we want to translate
+ * @param offsets Array of offsets
+ * @param zeroIfUnwritten Whether a page that was never written is left unmapped and answered with
+ * ZERO_FRAME (for reads, with VM_ZERO_PAGE_READS)
+ * @return The physical address of the given virtual address, or 0 if no page may be evicted to
+ * make room for it (every resident page is pinned, or its region is at its maximum and has no page
+ * to give up)
+ */
+uint64_t find_physical_address(uint64_t virtualAddress, uint64_t* offsets, bool zeroIfUnwritten) {
+    word_t nextFrame = 0;
+
+    uint64_t pageNumber = virtualAddress >> OFFSET_WIDTH;
+#ifndef VM_ZERO_PAGE_READS
+    (void) zeroIfUnwritten;
+#endif
+
+#ifdef VM_ADMISSION_FILTER
+    sketch_add(pageNumber);
+#endif
+
+    // the page is part of a cached run of consecutive frames - no need to walk the tables
+    uint64_t cachedFrame;
+    if (lookup_extent(pageNumber, &cachedFrame)) {
+        touch_frame((word_t) cachedFrame);
+        return promote_page(cachedFrame);
+    }
+
+    SearchArguments args = {0, (word_t) (usedFrames - 1), pageNumber, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+    // the last level table of the page is cached - start the walk from it
+    int firstLevel = 0;
+    if (lookup_walk_cache(pageNumber, &args.currentFrame)) {
+        firstLevel = TABLES_DEPTH - 1;
+    }
+
+    for (int i = firstLevel; i < TABLES_DEPTH; i++) {
+        if (i == TABLES_DEPTH - 1) {
+            record_walk_cache(pageNumber, args.currentFrame);
+        }
+
+        nextFrame = read_entry(args.currentFrame * PAGE_SIZE + offsets[i]);
+
+        // need to search for the next address
+        if (nextFrame == 0) {
+#ifdef VM_ZERO_PAGE_READS
+            // the page is not mapped - if it is not in the swap either, it was never written
+            if (zeroIfUnwritten && !is_swapped(pageNumber)) {
+                return ZERO_FRAME;
+            }
+#endif
+
+#ifdef VM_VICTIM_SEARCH_BUDGET
+            find_next_frame_bounded(&args);
+#elif defined(VM_EVICTION_SAMPLES)
+            find_next_frame_sampled(&args);
+#elif defined(VM_SEARCH_THREADS)
+            find_next_frame_parallel(&args);
+#else
+            find_next_frame(&args, 0, 0, 0, 0, 0);
+#endif
+            args.maxFrame++;
+            stats.framesScanned += args.framesScanned;
+
+            // 1st priority - empty frame, unlink it from its parent
+            if (args.priority == 1) {
+                nextFrame = args.emptyFrame;
+                unlink_table(nextFrame, args.emptyParent);
+            }
+
+            // 2nd priority - unused frame
+            else if (args.priority == 2) {
+                nextFrame = args.maxFrame;
+            }
+
+            // 3rd priority - evicted the frame with the maximal cyclic distance
+            else if (args.priority == 3) {
+                nextFrame = args.maxCyclicFrame;
+            }
+
+#ifdef BOUNCE_FRAME
+            // not admitted, or no page may be evicted - serve the page from the bounce frame
+            // (the tables mapped so far stay as they are and are reused as empty tables later)
+            else {
+                stats.bounced++;
+                bounceDirty = load_page(BOUNCE_FRAME, pageNumber);
+                return BOUNCE_FRAME;
+            }
+#else
+            // no page may be evicted - the page cannot be mapped (the tables mapped so far stay
+            // as they are and are reused as empty tables later)
+            else {
+                return 0;
+            }
+#endif
+
+            link_frame(args.currentFrame, offsets[i], nextFrame, pageNumber,
+                       i == TABLES_DEPTH - 1);
+
+            // found the physical address
+            if (i == TABLES_DEPTH - 1) {
+                stats.faults++;
+                regions[region_of(pageNumber)].stats.faults++;
+                tierStats[tier_of(nextFrame)].faults++;
+                bool restored = load_page(nextFrame, args.pageNumber);
+                record_extent(args.pageNumber, nextFrame);
+#ifdef VM_SWAP_READAHEAD
+                if (restored) {
+                    read_ahead(args.currentFrame, args.pageNumber);
+                }
+#else
+                (void) restored;
+#endif
+            }
+
+            // unlink it from its parent
+            else {
+                for (int j = 0; j < PAGE_SIZE; j++) {
+                    PMwrite(nextFrame * PAGE_SIZE + j, 0);
+                }
+            }
+        }
+
+        args = {nextFrame, (word_t) (usedFrames - 1), pageNumber, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    }
+
+    touch_frame(nextFrame);
+    return promote_page(nextFrame);
+}
+
+
+/**
+ * Checks whether the given virtual address can be mapped to a physical address
+ *
+ * @param virtualAddress The virtual address
+ * @return True if the address is inside the virtual memory
+ */
+bool is_valid_address(uint64_t virtualAddress) {
+    if (virtualAddress >= VIRTUAL_MEMORY_SIZE) {
+        return false;
+    }
+
+    return (virtualAddress >> OFFSET_WIDTH) < NUM_PAGES;
+}
+
+
+/**
+ * Finds the frame of a page without faulting it in
+ *
+ * @param pageNumber The virtual page number
+ * @return The frame the page is mapped to, or 0 if the page is not in the physical memory
+ */
+word_t find_resident_frame(uint64_t pageNumber) {
+    uint64_t offsets[TABLES_DEPTH + 1];
+    init_offsets(pageNumber << OFFSET_WIDTH, offsets);
+
+    word_t frame = 0;
+    int firstLevel = 0;
+    if (lookup_walk_cache(pageNumber, &frame)) {
+        firstLevel = TABLES_DEPTH - 1;
+    }
+
+    for (int i = firstLevel; i < TABLES_DEPTH; i++) {
+        frame = read_entry(frame * PAGE_SIZE + offsets[i]);
+
+        // the path to the page is not mapped
+        if (frame == 0) {
+            return 0;
+        }
+    }
+
+    return frame;
+}
+
+
+/**
+ * Checks whether a translation answered a read with zeros instead of mapping the page
+ * (VM_ZERO_PAGE_READS)
+ *
+ * @param frame The frame returned by the translation
+ * @return True if the frame is ZERO_FRAME
+ */
+bool is_zero_frame(uint64_t frame) {
+#ifdef VM_ZERO_PAGE_READS
+    return frame == ZERO_FRAME;
+#else
+    (void) frame;
+    return false;
+#endif
+}
+
+
+/**
+ * What the consistency check found so far
+ */
+struct CheckState {
+    bool referenced[NUM_FRAMES];  // whether an entry points to the frame
+    uint64_t pages;  // resident pages found in the tree
+    uint64_t regionFrames[PAGE_SIZE];  // frames found in each region
+};
+
+
+/**
+ * Checks a table and the tables below it against the frame table
+ *
+ * @param state What the check found so far
+ * @param table The frame of the table
+ * @param prefix The virtual address of the table
+ * @param depth The depth of the table in the tree
+ * @return True if the subtree is consistent
+ */
+bool check_subtree(CheckState* state, word_t table, uint64_t prefix, uint64_t depth) {
+    word_t children = 0;
+    uint64_t emptyTablesBelow = 0;
+    uint64_t pagesBelow = 0;
+
+    for (uint64_t i = 0; i < PAGE_SIZE; i++) {
+        uint64_t entry = table * PAGE_SIZE + i;
+        word_t child = read_entry(entry);
+        if (child == 0) {
+            continue;
+        }
+
+        // the child is a frame in use that no other entry points to, and its reverse map and
+        // the path to it agree
+        uint64_t childPrefix = (prefix << OFFSET_WIDTH) + i;
+        bool isLeaf = depth + 1 == TABLES_DEPTH;
+        if ((uint64_t) child >= (uint64_t) usedFrames || state->referenced[child] ||
+            frames[child].parentEntry != entry || frames[child].isLeaf != isLeaf ||
+            (frames[child].page >> (OFFSET_WIDTH * (TABLES_DEPTH - depth - 1))) != childPrefix) {
+            return false;
+        }
+        state->referenced[child] = true;
+        state->regionFrames[region_of(frames[child].page)]++;
+        children++;
+
+        if (isLeaf) {
+            if (frames[child].residentSlot >= residentCount ||
+                residentFrames[frames[child].residentSlot] != child || is_swapped(childPrefix) ||
+                frames[child].emptyTablesBelow != 0 || frames[child].pagesBelow != 1) {
+                return false;
+            }
+            state->pages++;
+        }
+        else if (!check_subtree(state, child, childPrefix, depth + 1)) {
+            return false;
+        }
+
+        emptyTablesBelow += frames[child].emptyTablesBelow;
+        pagesBelow += frames[child].pagesBelow;
+    }
+
+    if (table != 0 && children == 0) {
+        emptyTablesBelow = 1;
+    }
+
+    return frames[table].children == children &&
+           frames[table].emptyTablesBelow == emptyTablesBelow &&
+           frames[table].pagesBelow == pagesBelow;
+}
+
+
+/**
+ * Checks that the tables, the frame table and the caches agree
+ *
+ * @return True if all the invariants hold
+ */
+bool check_consistency() {
+    CheckState state;
+    for (uint64_t i = 0; i < NUM_FRAMES; i++) {
+        state.referenced[i] = false;
+    }
+    for (uint64_t i = 0; i < PAGE_SIZE; i++) {
+        state.regionFrames[i] = 0;
+    }
+    state.pages = 0;
+
+    if (!check_subtree(&state, 0, 0, 0) || state.pages != residentCount) {
+        return false;
+    }
+
+    // the frames in use are exactly the frames in the tree
+    for (word_t frame = 1; frame < usedFrames; frame++) {
+        if (!state.referenced[frame]) {
+            return false;
+        }
+    }
+
+    for (uint64_t i = 0; i < PAGE_SIZE; i++) {
+        if (regions[i].stats.frames != state.regionFrames[i]) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < hazardCount; i++) {
+        if (!state.referenced[hazardFrames[i]] || !frames[hazardFrames[i]].isLeaf) {
+            return false;
+        }
+    }
+
+    // the caches translate only to what the tables map
+    for (int i = 0; i < VM_WALK_CACHE_ENTRIES; i++) {
+        WalkCacheEntry* entry = &walkCache[i];
+
+        if (entry->version != 0 && frameVersions[entry->table] == entry->version &&
+            entry->table != 0 && (!state.referenced[entry->table] || frames[entry->table].isLeaf ||
+                                  (frames[entry->table].page >> OFFSET_WIDTH) != entry->prefix)) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < VM_TLB_EXTENTS; i++) {
+        TranslationExtent* extent = &cachedExtents[i];
+
+        for (uint64_t j = 0; j < extent->length; j++) {
+            if (find_resident_frame(extent->pageBase + j) != (word_t) (extent->frameBase + j)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Counts an operation that accessed the virtual memory or changed the tables - with
+ * VM_CHECK_INTERVAL, checks the consistency every that many operations and aborts if it is broken
+ */
+void count_operation() {
+#ifdef VM_CHECK_INTERVAL
+    static uint64_t operations = 0;
+
+    if (++operations % VM_CHECK_INTERVAL == 0 && !check_consistency()) {
+        fprintf(stderr, "VirtualMemory: inconsistent tables after %llu operations\n",
+                (unsigned long long) operations);
+        abort();
+    }
+#endif
+}
+
+
+/**
+ * Releases the bookkeeping of the heap - every allocation is forgotten
+ */
+void release_heap() {
+    if (heap == nullptr) {
+        return;
+    }
+
+    for (uint64_t page = 0; page < NUM_PAGES; page++) {
+        free(heap->pages[page].slots);
+    }
+    free(heap);
+    heap = nullptr;
+}
+
+
+/**
+ * Initialize the virtual memory.
+ */
+void VMinitialize() {
+    clear_extents();
+    mappingEpoch++;
+    hazardCount = 0;
+    for (int i = 0; i < VM_WALK_CACHE_ENTRIES; i++) {
+        walkCache[i].version = 0;
+    }
+    // every frame loses its mapping - translations held by cursors are stale
+    for (uint64_t i = 0; i < NUM_FRAMES; i++) {
+        frameVersions[i]++;
+    }
+    usedFrames = 1;
+    stats = {0, 0, 0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < NUM_TIERS; i++) {
+        tierStats[i] = {0, 0, 0};
+    }
+    release_heap();
+    residentCount = 0;
+    accessClock = 0;
+    frames[0].children = 0;
+    frames[0].emptyTablesBelow = 0;
+    frames[0].pagesBelow = 0;
+    for (int i = 0; i < PAGE_SIZE; i++) {
+        regions[i].stats = {0, 0, 0};
+    }
+#ifdef VM_VICTIM_SEARCH_BUDGET
+    searchCursor = 0;
+#endif
+#ifdef VM_EVICTION_SAMPLES
+    emptyTablesCount = 0;
+    sampleSeed = 1;
+#endif
+#ifdef VM_ADMISSION_FILTER
+    sketchAdditions = 0;
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        for (uint64_t i = 0; i < VM_SKETCH_WIDTH; i++) {
+            sketch[row][i] = 0;
+        }
+    }
+#endif
+
+    for (int i = 0; i < PAGE_SIZE; i++) {
+        PMwrite(i, 0);
+    }
+}
+
+
+/**
+ * Reads a word from the given virtual address
+ * and puts its content in *value.
+ *
+ * returns 1 on success.
+ * returns 0 on failure (if the address cannot be mapped to a physical
+ * address for any reason)
+ */
+int VMread(uint64_t virtualAddress, word_t* value) {
+    if (!is_valid_address(virtualAddress)) {
+        return 0;
+    }
+
+    uint64_t offsets[TABLES_DEPTH + 1];
+    init_offsets(virtualAddress, offsets);
+
+    uint64_t physical_address = find_physical_address(virtualAddress, offsets, true);
+
+    // no page could be evicted to make room for the page
+    if (physical_address == 0) {
+        return 0;
+    }
+
+    // a page that was never written reads as zeros - no need to allocate its tables and frame
+    if (is_zero_frame(physical_address)) {
+        *value = 0;
+        stats.zeroReads++;
+    }
+    else {
+        PMread(physical_address * PAGE_SIZE + offsets[TABLES_DEPTH], value);
+        release_frame(physical_address, virtualAddress >> OFFSET_WIDTH);
+    }
+    count_operation();
+
+    return 1;
+}
+
+
+/**
+ * Writes a word to the given virtual address.
+ *
+ * returns 1 on success.
+ * returns 0 on failure (if the address cannot be mapped to a physical
+ * address for any reason)
+ */
+int VMwrite(uint64_t virtualAddress, word_t value) {
+    if (!is_valid_address(virtualAddress)) {
+        return 0;
+    }
+
+    uint64_t offsets[TABLES_DEPTH + 1];
+    init_offsets(virtualAddress, offsets);
+
+    uint64_t physical_address = find_physical_address(virtualAddress, offsets, false);
+
+    // no page could be evicted to make room for the page
+    if (physical_address == 0) {
+        return 0;
+    }
+
+    PMwrite(physical_address * PAGE_SIZE + offsets[TABLES_DEPTH], value);
+    record_write(physical_address);
+    release_frame(physical_address, virtualAddress >> OFFSET_WIDTH);
+    count_operation();
+
+    return 1;
+}
+
+
+// batches of at most this many addresses are grouped by page on the stack
+#define BATCH_STACK 256
+
+// batches of at most this many addresses are grouped by comparisons - the passes of the radix
+// sort cost more than a few comparisons
+#define BATCH_COMPARE 16
+
+/**
+ * Sorts keys that hold a virtual page number above an index of indexBits bits by the page number
+ * (a radix sort of 8 bits per pass, so a batch is grouped in linear time). A pass is skipped when
+ * all the pages share its digit, as the few pages of a batch usually share the higher ones.
+ *
+ * @param keys The keys
+ * @param buffer Room for count keys
+ * @param count The number of keys
+ * @param indexBits The number of bits below the page number
+ */
+void sort_by_page(uint64_t* keys, uint64_t* buffer, uint64_t count, uint64_t indexBits) {
+    for (uint64_t shift = indexBits; shift < indexBits + VIRTUAL_ADDRESS_WIDTH - OFFSET_WIDTH;
+         shift += 8) {
+        uint64_t starts[257] = {0};
+        for (uint64_t i = 0; i < count; i++) {
+            starts[((keys[i] >> shift) & 255) + 1]++;
+        }
+        if (starts[((keys[0] >> shift) & 255) + 1] == count) {
+            continue;
+        }
+
+        for (int digit = 0; digit < 256; digit++) {
+            starts[digit + 1] += starts[digit];
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            buffer[starts[(keys[i] >> shift) & 255]++] = keys[i];
+        }
+        std::copy(buffer, buffer + count, keys);
+    }
+}
+
+
+/**
+ * Reads count words from the given virtual addresses into values.
+ *
+ * The addresses are visited page by page - through a permutation sorted by page, unless the batch
+ * already is - so the batch costs one table walk per distinct page instead of one per word,
+ * whatever the order of the addresses. If the permutation cannot be allocated, the addresses are
+ * visited in order, and only consecutive addresses on the same page share a walk.
+ *
+ * returns 1 on success.
+ * returns 0 if any of the addresses is invalid (nothing is read in that case) or a page could
+ * not be mapped
+ */
+int VMreadBatch(const uint64_t* virtualAddresses, word_t* values, uint64_t count) {
+    bool sorted = true;
+    for (uint64_t i = 0; i < count; i++) {
+        if (!is_valid_address(virtualAddresses[i])) {
+            return 0;
+        }
+        uint64_t pageNumber = virtualAddresses[i] >> OFFSET_WIDTH;
+        if (i > 0 && pageNumber < (virtualAddresses[i - 1] >> OFFSET_WIDTH)) {
+            sorted = false;
+        }
+    }
+
+    // the permutation holds the page of each address above its index, followed by the buffer of
+    // the sort
+    uint64_t indexBits = 0;
+    while (indexBits < 64 && (count >> indexBits) != 0) {
+        indexBits++;
+    }
+    uint64_t stackOrder[2 * BATCH_STACK];
+    uint64_t* order = nullptr;
+    if (!sorted && count <= BATCH_STACK) {
+        order = stackOrder;
+    }
+    else if (!sorted && indexBits + VIRTUAL_ADDRESS_WIDTH - OFFSET_WIDTH <= 64) {
+        order = (uint64_t*) malloc(2 * count * sizeof(uint64_t));
+    }
+    if (order != nullptr) {
+        for (uint64_t i = 0; i < count; i++) {
+            order[i] = ((virtualAddresses[i] >> OFFSET_WIDTH) << indexBits) | i;
+        }
+        if (count <= BATCH_COMPARE) {
+            std::sort(order, order + count);
+        }
+        else {
+            sort_by_page(order, order + count, count, indexBits);
+        }
+    }
+
+    uint64_t offsets[TABLES_DEPTH + 1];
+    uint64_t lastPage = NUM_PAGES;  // no page translated yet
+    uint64_t frame = 0;
+    bool zero = false;  // the current page was never written and is not mapped
+
+    for (uint64_t j = 0; j < count; j++) {
+        uint64_t i = order != nullptr ? order[j] & (((uint64_t) 1 << indexBits) - 1) : j;
+        uint64_t pageNumber = virtualAddresses[i] >> OFFSET_WIDTH;
+
+        // only walk the tables when moving to a different page - reading cannot evict the
+        // frame of the page we are currently on
+        if (pageNumber != lastPage) {
+            if (lastPage != NUM_PAGES && !zero) {
+                release_frame(frame, lastPage);
+            }
+
+            init_offsets(virtualAddresses[i], offsets);
+            frame = find_physical_address(virtualAddresses[i], offsets, true);
+            if (frame == 0) {
+                if (order != stackOrder) {
+                    free(order);
+                }
+                return 0;
+            }
+            zero = is_zero_frame(frame);
+            lastPage = pageNumber;
+        }
+
+        if (zero) {
+            values[i] = 0;
+            stats.zeroReads++;
+        }
+        else {
+            PMread(frame * PAGE_SIZE + (virtualAddresses[i] & (PAGE_SIZE - 1)), &values[i]);
+        }
+    }
+
+    if (lastPage != NUM_PAGES && !zero) {
+        release_frame(frame, lastPage);
+    }
+
+    if (order != stackOrder) {
+        free(order);
+    }
+    count_operation();
+    return 1;
+}
+
+
+/**
+ * Reads count consecutive words starting at the given virtual address into values, translating
+ * every page of the range once.
+ *
+ * With VM_STREAMING_READS, pages of the range that are not in the physical memory are read
+ * through the bounce frame and go straight back to the swap (pages that were never written read
+ * as zeros and are not written to it), so a bulk scan does not evict the working set of other
+ * accesses.
+ *
+ * returns 1 on success.
+ * returns 0 if the range exceeds the virtual memory (nothing is read in that case) or a page
+ * could not be mapped
+ */
+int VMreadRange(uint64_t virtualAddress, word_t* values, uint64_t count) {
+    if (count > VIRTUAL_MEMORY_SIZE || virtualAddress > VIRTUAL_MEMORY_SIZE - count) {
+        return 0;
+    }
+
+    uint64_t done = 0;
+
+    while (done < count) {
+        uint64_t address = virtualAddress + done;
+        uint64_t pageNumber = address >> OFFSET_WIDTH;
+        uint64_t offset = address & (PAGE_SIZE - 1);
+        uint64_t words = PAGE_SIZE - offset;
+        if (words > count - done) {
+            words = count - done;
+        }
+
+        uint64_t frame;
+#ifdef VM_STREAMING_READS
+        if (!lookup_extent(pageNumber, &frame)) {
+            frame = find_resident_frame(pageNumber);
+        }
+
+#ifdef VM_ZERO_PAGE_READS
+        // not in the physical memory nor in the swap - it was never written
+        if (frame == 0 && !is_swapped(pageNumber)) {
+            frame = ZERO_FRAME;
+        }
+#endif
+
+        // not in the physical memory - stream it through the bounce frame
+        if (frame == 0) {
+            frame = BOUNCE_FRAME;
+            bounceDirty = load_page((word_t) frame, pageNumber);
+        }
+        else if (!is_zero_frame(frame)) {
+            touch_frame((word_t) frame);
+        }
+#else
+        uint64_t offsets[TABLES_DEPTH + 1];
+        init_offsets(address, offsets);
+        frame = find_physical_address(address, offsets, true);
+        if (frame == 0) {
+            return 0;
+        }
+#endif
+
+        // a page that was never written reads as zeros
+        if (is_zero_frame(frame)) {
+            for (uint64_t i = 0; i < words; i++) {
+                values[done + i] = 0;
+            }
+
+            stats.zeroReads += words;
+            done += words;
+            continue;
+        }
+
+        for (uint64_t i = 0; i < words; i++) {
+            PMread(frame * PAGE_SIZE + offset + i, &values[done + i]);
+        }
+
+        release_frame(frame, pageNumber);
+        done += words;
+    }
+
+    count_operation();
+    return 1;
+}
+
+/**
+ * Relocates frames so that the resident pages of the given virtual range are stored in runs of
+ * consecutive frames. Every resident page is moved right after the frame of the page before it,
+ * swapping with whatever table or page was stored there. Pinned pages are not moved.
+ *
+ * The work is bounded by maxMoves, so a hot region can be compacted incrementally by calling this
+ * again with the same range.
+ *
+ * returns the number of frames that were relocated.
+ */
+uint64_t VMcompact(uint64_t virtualAddress, uint64_t numPages, uint64_t maxMoves) {
+    uint64_t firstPage = virtualAddress >> OFFSET_WIDTH;
+    uint64_t moves = 0;
+    word_t previousFrame = 0;  // the frame of the previous page in the range (0 if not resident)
+
+    for (uint64_t page = firstPage; page < firstPage + numPages && page < NUM_PAGES; page++) {
+        word_t frame = find_resident_frame(page);
+
+        // the run continues only if the target frame is in use - swapping with an unused frame
+        // would leave a hole in the prefix of used frames
+        if (frame != 0 && previousFrame != 0 && frame != previousFrame + 1 &&
+            previousFrame + 1 < usedFrames && !is_hazard(frame) &&
+            !is_hazard(previousFrame + 1)) {
+            if (moves == maxMoves) {
+                break;
+            }
+
+            swap_frames(frame, previousFrame + 1);
+            frame = previousFrame + 1;
+            moves++;
+        }
+
+        previousFrame = frame;
+    }
+
+    // pages moved to other frames - the cached extents are stale
+    if (moves > 0) {
+        mappingEpoch++;
+        clear_extents();
+    }
+
+    count_operation();
+    return moves;
+}
+
+
+/**
+ * Copies the paging counters collected since VMinitialize into *stats.
+ */
+void VMgetStats(VMstats* out) {
+    *out = stats;
+}
+
+
+/**
+ * Sets the frame quota of a region - the part of the virtual memory mapped by one entry of the
+ * root table. While the region uses no more than minFrames frames its pages are evicted only if
+ * no other page can be, and it never uses more than maxFrames frames (0 for no limit) - once it
+ * reaches the limit its faults evict its own pages. Regions over their maximum are evicted first.
+ * A fault of a region at its limit with no page it may evict (they are pinned) fails, or is
+ * served through the bounce frame where there is one.
+ *
+ * returns 1 on success.
+ * returns 0 if the region does not exist or the quota is invalid
+ */
+int VMsetRegionQuota(uint64_t region, uint64_t minFrames, uint64_t maxFrames) {
+    if (region >= PAGE_SIZE) {
+        return 0;
+    }
+
+    // the region needs a frame for each of its tables and one for a page
+    if (maxFrames != 0 && (maxFrames < TABLES_DEPTH || minFrames > maxFrames)) {
+        return 0;
+    }
+
+    regions[region].minFrames = minFrames;
+    regions[region].maxFrames = maxFrames;
+    return 1;
+}
+
+
+/**
+ * Copies the frame usage and paging counters of a region into *stats.
+ *
+ * returns 1 on success.
+ * returns 0 if the region does not exist
+ */
+int VMgetRegionStats(uint64_t region, VMregionStats* out) {
+    if (region >= PAGE_SIZE) {
+        return 0;
+    }
+
+    *out = regions[region].stats;
+    return 1;
+}
+
+
+/**
+ * Returns the mapping epoch - it changes whenever a page is unmapped or moved to another frame,
+ * before that frame is reused. A physical address obtained for a page is valid as long as the
+ * epoch has not changed since.
+ */
+uint64_t VMgetMappingEpoch() {
+    return mappingEpoch;
+}
+
+
+/**
+ * Pins the page of the given virtual address - the page is mapped to a frame and stays in that
+ * frame (it is neither evicted nor moved) until it is unpinned.
+ *
+ * returns 1 on success.
+ * returns 0 if the address is invalid, all the hazard slots are taken or the page could not be
+ * mapped
+ */
+int VMpin(uint64_t virtualAddress) {
+    if (!is_valid_address(virtualAddress) || hazardCount == VM_HAZARD_SLOTS) {
+        return 0;
+    }
+
+    uint64_t offsets[TABLES_DEPTH + 1];
+    init_offsets(virtualAddress, offsets);
+    uint64_t frame = find_physical_address(virtualAddress, offsets, false);
+    if (frame == 0) {
+        return 0;
+    }
+
+#ifdef BOUNCE_FRAME
+    // the page was not admitted to the memory
+    if (frame == BOUNCE_FRAME) {
+        release_frame(frame, virtualAddress >> OFFSET_WIDTH);
+        count_operation();
+        return 0;
+    }
+#endif
+
+    hazardFrames[hazardCount++] = (word_t) frame;
+    count_operation();
+    return 1;
+}
+
+
+/**
+ * Unpins the page of the given virtual address (once for every time it was pinned).
+ *
+ * returns 1 on success.
+ * returns 0 if the page is not pinned
+ */
+int VMunpin(uint64_t virtualAddress) {
+    if (!is_valid_address(virtualAddress)) {
+        return 0;
+    }
+
+    // a pinned page is always in the memory
+    word_t frame = find_resident_frame(virtualAddress >> OFFSET_WIDTH);
+
+    for (int i = 0; i < hazardCount && frame != 0; i++) {
+        if (hazardFrames[i] == frame) {
+            hazardFrames[i] = hazardFrames[--hazardCount];
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+// the header of an image written by VMexport
+#define IMAGE_MAGIC 0x50534d56  // "VMSP" in little-endian byte order
+#define IMAGE_HEADER_WORDS 4  // the magic, the word size, PAGE_SIZE and NUM_PAGES
+
+
+/**
+ * Writes a value in little-endian byte order
+ *
+ * @param file The file
+ * @param value The value
+ * @param bytes The number of bytes to write
+ * @return True on success
+ */
+bool write_le(FILE* file, uint64_t value, uint64_t bytes) {
+    unsigned char buffer[sizeof(uint64_t)];
+    for (uint64_t i = 0; i < bytes; i++) {
+        buffer[i] = (unsigned char) (value >> (8 * i));
+    }
+    return fwrite(buffer, 1, bytes, file) == bytes;
+}
+
+
+/**
+ * Reads a value in little-endian byte order
+ *
+ * @param file The file
+ * @param value Output - the value
+ * @param bytes The number of bytes to read
+ * @return True on success
+ */
+bool read_le(FILE* file, uint64_t* value, uint64_t bytes) {
+    unsigned char buffer[sizeof(uint64_t)];
+    if (fread(buffer, 1, bytes, file) != bytes) {
+        return false;
+    }
+
+    *value = 0;
+    for (uint64_t i = 0; i < bytes; i++) {
+        *value |= (uint64_t) buffer[i] << (8 * i);
+    }
+    return true;
+}
+
+
+/**
+ * Picks a frame to stream a page of the swap through without mapping it - the bounce frame, a
+ * frame that is not in use, or else the frame of the first resident page, which is written to the
+ * swap meanwhile (a PMevict and a PMrestore of that page for every page streamed)
+ *
+ * @param borrowedPage Output - the page to put back in the frame afterwards (NUM_PAGES if none)
+ * @return The frame, or 0 if every frame holds a table
+ */
+word_t acquire_scratch_frame(uint64_t* borrowedPage) {
+    *borrowedPage = NUM_PAGES;
+
+#ifdef BOUNCE_FRAME
+    return BOUNCE_FRAME;
+#else
+    if (usedFrames < NUM_FRAMES) {
+        return usedFrames;
+    }
+    if (residentCount == 0) {
+        return 0;
+    }
+
+    word_t frame = residentFrames[0];
+    *borrowedPage = frames[frame].page;
+    evict_page(frame, *borrowedPage);
+    return frame;
+#endif
+}
+
+
+/**
+ * Gives back a frame picked by acquire_scratch_frame
+ *
+ * @param frame The frame
+ * @param borrowedPage The page to put back in the frame (NUM_PAGES if none)
+ */
+void release_scratch_frame(word_t frame, uint64_t borrowedPage) {
+    if (borrowedPage != NUM_PAGES) {
+        restore_page(frame, borrowedPage);
+    }
+}
+
+
+/**
+ * Writes a page of an image
+ *
+ * @param file The file
+ * @param pageNumber The virtual page number
+ * @param frame The frame that holds the page
+ * @return True on success
+ */
+bool export_page(FILE* file, uint64_t pageNumber, word_t frame) {
+    if (!write_le(file, pageNumber, sizeof(uint64_t))) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < PAGE_SIZE; i++) {
+        word_t value;
+        PMread(frame * PAGE_SIZE + i, &value);
+
+        if (!write_le(file, (uint64_t) value, sizeof(word_t))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * Writes the contents of the virtual memory to a file, in page order. Only pages that hold data -
+ * resident pages and pages in the swap - are written. Pages in the swap are streamed through a
+ * spare frame without being mapped, and the pages in the physical memory are not accessed, so
+ * the eviction order is not affected. Without a bounce frame and with every frame in use, the
+ * spare frame is borrowed from a resident page, which goes to the swap and back for every page
+ * streamed.
+ *
+ * returns 1 on success.
+ * returns 0 if writing the file failed or a page in the swap could not be read (every frame holds
+ * a table)
+ */
+int VMexport(FILE* file) {
+    if (!write_le(file, IMAGE_MAGIC, 4) || !write_le(file, sizeof(word_t), 4) ||
+        !write_le(file, PAGE_SIZE, sizeof(uint64_t)) ||
+        !write_le(file, NUM_PAGES, sizeof(uint64_t))) {
+        return 0;
+    }
+
+    // the resident pages sorted by page number, merged with the pages in the swap below
+    uint64_t residentPages[NUM_FRAMES];
+    uint64_t count = residentCount;
+    for (uint64_t i = 0; i < count; i++) {
+        residentPages[i] = frames[residentFrames[i]].page;
+    }
+    std::sort(residentPages, residentPages + count);
+
+    uint64_t next = 0;
+    for (uint64_t word = 0; word < (NUM_PAGES + 63) / 64 || next < count; word++) {
+        uint64_t firstPage = word * 64;
+        uint64_t swapped = word < (NUM_PAGES + 63) / 64 ? swappedPages[word] : 0;
+
+        for (uint64_t bit = 0; bit < 64; bit++) {
+            uint64_t page = firstPage + bit;
+
+            if (next < count && residentPages[next] == page) {
+                next++;
+                if (!export_page(file, page, find_resident_frame(page))) {
+                    return 0;
+                }
+            }
+
+            else if ((swapped >> bit) & 1) {
+                uint64_t borrowedPage;
+                word_t frame = acquire_scratch_frame(&borrowedPage);
+                if (frame == 0) {
+                    return 0;
+                }
+
+                restore_page(frame, page);
+                bool written = export_page(file, page, frame);
+                evict_page(frame, page);
+                release_scratch_frame(frame, borrowedPage);
+
+                if (!written) {
+                    return 0;
+                }
+            }
+        }
+    }
+
+    return 1;
+}
+
+
+/**
+ * Reads an image written by VMexport into the virtual memory. Resident pages are overwritten in
+ * place and the other pages are written straight to the swap through a spare frame, so the
+ * eviction order is not affected. The spare frame costs the same as in VMexport. Pages that are
+ * not in the image keep their contents.
+ *
+ * returns 1 on success.
+ * returns 0 if the file is not an image of this virtual memory, it is truncated (in the middle of
+ * a record too) or a page could not be written (the pages before the failure are imported)
+ */
+int VMimport(FILE* file) {
+    uint64_t header[IMAGE_HEADER_WORDS];
+    if (!read_le(file, &header[0], 4) || !read_le(file, &header[1], 4) ||
+        !read_le(file, &header[2], sizeof(uint64_t)) ||
+        !read_le(file, &header[3], sizeof(uint64_t))) {
+        return 0;
+    }
+    if (header[0] != IMAGE_MAGIC || header[1] != sizeof(word_t) || header[2] != PAGE_SIZE ||
+        header[3] != NUM_PAGES) {
+        return 0;
+    }
+
+    while (true) {
+        // the image may only end between records
+        int next = fgetc(file);
+        if (next == EOF) {
+            break;
+        }
+        ungetc(next, file);
+
+        uint64_t page;
+        if (!read_le(file, &page, sizeof(uint64_t))) {
+            return 0;
+        }
+
+        word_t values[PAGE_SIZE];
+        for (uint64_t i = 0; i < PAGE_SIZE; i++) {
+            uint64_t value;
+            if (!read_le(file, &value, sizeof(word_t))) {
+                return 0;
+            }
+            values[i] = (word_t) value;
+        }
+        if (page >= NUM_PAGES) {
+            return 0;
+        }
+
+        word_t frame = find_resident_frame(page);
+        bool resident = frame != 0;
+        uint64_t borrowedPage = NUM_PAGES;
+        if (!resident) {
+            frame = acquire_scratch_frame(&borrowedPage);
+            if (frame == 0) {
+                return 0;
+            }
+
+            // the page is overwritten - restoring it only drops its copy in the swap
+            restore_page(frame, page);
+        }
+
+        for (uint64_t i = 0; i < PAGE_SIZE; i++) {
+            PMwrite(frame * PAGE_SIZE + i, values[i]);
+        }
+
+        if (resident) {
+            record_write(frame);
+        }
+        else {
+            evict_page(frame, page);
+            release_scratch_frame(frame, borrowedPage);
+        }
+        count_operation();
+    }
+
+    return ferror(file) ? 0 : 1;
+}
+
+
+/**
+ * Copies the layout of the swap into *stats - the pages in the swap and the runs of consecutive
+ * pages they form.
+ */
+void VMgetSwapStats(VMswapStats* stats) {
+    stats->pages = 0;
+    stats->runs = 0;
+
+    bool previous = false;
+    for (uint64_t page = 0; page < NUM_PAGES; page++) {
+        bool swapped = is_swapped(page);
+
+        if (swapped) {
+            stats->pages++;
+            if (!previous) {
+                stats->runs++;
+            }
+        }
+        previous = swapped;
+    }
+}
+
+
+/**
+ * Copies the counters of a tier into *stats - tier 0 is the fast tier and tier 1 is the slow
+ * tier (VM_FAST_FRAMES). Without VM_FAST_FRAMES all the frames are in tier 0.
+ *
+ * returns 1 on success.
+ * returns 0 if the tier does not exist
+ */
+int VMgetTierStats(uint64_t tier, VMtierStats* stats) {
+    if (tier >= NUM_TIERS) {
+        return 0;
+    }
+
+    *stats = tierStats[tier];
+    return 1;
+}
+
+
+/**
+ * Checks the invariants of the tables:
+ * - every entry points to a frame in use (never the root), and no frame is pointed to twice
+ * - every frame in use is in the tree, and the frame table (reverse map, resident pages,
+ *   summaries and region counters) matches the tree
+ * - pinned pages are resident, and the walk cache and the extents only translate what the tables
+ *   map
+ *
+ * returns 1 if all the invariants hold.
+ * returns 0 otherwise
+ */
+int VMcheckConsistency() {
+    return check_consistency() ? 1 : 0;
+}
+
+
+/**
+ * Translates a virtual address to the physical address of its word, mapping the page if needed.
+ * The caller may then access the word with PMread/PMwrite directly, as long as the mapping
+ * epoch does not change (or the page is pinned). A page that will be written through the
+ * physical address must be translated as writable, so it is written to the swap when evicted.
+ *
+ * returns 1 on success.
+ * returns 0 if the address is invalid or the page could not be mapped
+ */
+int VMtranslate(uint64_t virtualAddress, int writable, uint64_t* physicalAddress) {
+    if (!is_valid_address(virtualAddress)) {
+        return 0;
+    }
+
+    uint64_t offsets[TABLES_DEPTH + 1];
+    init_offsets(virtualAddress, offsets);
+    uint64_t frame = find_physical_address(virtualAddress, offsets, false);
+    if (frame == 0) {
+        return 0;
+    }
+
+#ifdef BOUNCE_FRAME
+    // the page was not admitted to the memory - it leaves the bounce frame right away
+    if (frame == BOUNCE_FRAME) {
+        release_frame(frame, virtualAddress >> OFFSET_WIDTH);
+        count_operation();
+        return 0;
+    }
+#endif
+
+    count_operation();
+    if (writable) {
+        record_write(frame);
+    }
+
+    *physicalAddress = frame * PAGE_SIZE + offsets[TABLES_DEPTH];
     return 1;
 }
 
 
 /**
- * Writes a word to the given virtual address.
+ * Translates the address of a cursor - a cached translation is used while the frame holds the
+ * same mapping (its version did not change), otherwise the tables are walked once and the
+ * translation is cached in the cursor
+ *
+ * @param cursor The cursor
+ * @param writable Whether the word will be written
+ * @return The frame of the page - the bounce frame (released by the caller) if the page was not
+ * admitted, ZERO_FRAME if a read of a page that was never written is answered with zeros, or 0 if
+ * the page could not be mapped
+ */
+uint64_t cursor_translate(VMcursor* cursor, bool writable) {
+    uint64_t page = cursor->address >> OFFSET_WIDTH;
+
+    if (cursor->page == page && frameVersions[cursor->frame] == cursor->version &&
+        (cursor->writable || !writable)) {
+        touch_frame((word_t) cursor->frame);
+        return cursor->frame;
+    }
+
+    uint64_t offsets[TABLES_DEPTH + 1];
+    init_offsets(cursor->address, offsets);
+    uint64_t frame = find_physical_address(cursor->address, offsets, !writable);
+
+    // nothing to cache - the page is not mapped
+    cursor->page = NUM_PAGES;
+    if (frame == 0 || is_zero_frame(frame)) {
+        return frame;
+    }
+
+    if (writable) {
+        record_write(frame);
+    }
+#ifdef BOUNCE_FRAME
+    if (frame == BOUNCE_FRAME) {
+        return frame;
+    }
+#endif
+    cursor->page = page;
+    cursor->frame = frame;
+    cursor->version = frameVersions[frame];
+    cursor->writable = writable;
+    return frame;
+}
+
+
+/**
+ * Places a cursor at the given virtual address, with no cached translation.
+ */
+void VMcursorInit(VMcursor* cursor, uint64_t virtualAddress) {
+    cursor->address = virtualAddress;
+    cursor->page = NUM_PAGES;
+    cursor->frame = 0;
+    cursor->version = 0;
+    cursor->writable = false;
+}
+
+
+/**
+ * Moves a cursor by the given number of words (negative to move backward). The translation is
+ * kept, and is used again if the cursor is still on the same page.
+ */
+void VMcursorMove(VMcursor* cursor, int64_t words) {
+    cursor->address += (uint64_t) words;
+}
+
+
+/**
+ * Reads the word at the cursor into *value.
  *
  * returns 1 on success.
- * returns 0 on failure (if the address cannot be mapped to a physical
- * address for any reason)
+ * returns 0 if the address of the cursor is invalid or its page could not be mapped
  */
-int VMwrite(uint64_t virtualAddress, word_t value) {
-    if (virtualAddress >= VIRTUAL_MEMORY_SIZE) {
+int VMcursorRead(VMcursor* cursor, word_t* value) {
+    if (!is_valid_address(cursor->address)) {
+        return 0;
+    }
+
+    uint64_t frame = cursor_translate(cursor, false);
+    if (frame == 0) {
+        return 0;
+    }
+
+    // a page that was never written reads as zeros
+    if (is_zero_frame(frame)) {
+        *value = 0;
+        stats.zeroReads++;
+    }
+    else {
+        PMread(frame * PAGE_SIZE + (cursor->address & (PAGE_SIZE - 1)), value);
+        release_frame(frame, cursor->address >> OFFSET_WIDTH);
+    }
+    count_operation();
+    return 1;
+}
+
+
+/**
+ * Writes a word at the cursor.
+ *
+ * returns 1 on success.
+ * returns 0 if the address of the cursor is invalid or its page could not be mapped
+ */
+int VMcursorWrite(VMcursor* cursor, word_t value) {
+    if (!is_valid_address(cursor->address)) {
+        return 0;
+    }
+
+    uint64_t frame = cursor_translate(cursor, true);
+    if (frame == 0) {
+        return 0;
+    }
+    PMwrite(frame * PAGE_SIZE + (cursor->address & (PAGE_SIZE - 1)), value);
+    release_frame(frame, cursor->address >> OFFSET_WIDTH);
+    count_operation();
+    return 1;
+}
+
+
+/**
+ * Drops a resident page from the physical memory without writing it to the swap. The frame is
+ * freed by moving the last frame in use into it, so the frames in use stay a prefix. If the last
+ * frame in use is pinned, it cannot move - the page keeps its frame and only loses its contents.
+ *
+ * @param frame The frame of the page
+ * @return True if the page was dropped, false if it is pinned
+ */
+bool drop_resident_page(word_t frame) {
+    if (is_hazard(frame)) {
+        return false;
+    }
+
+    word_t last = usedFrames - 1;
+    if (frame != last && is_hazard(last)) {
+#ifdef VM_DROP_CLEAN_PAGES
+        for (int i = 0; i < PAGE_SIZE; i++) {
+            PMwrite(frame * PAGE_SIZE + i, 0);
+        }
+        frames[frame].clean = true;
+#endif
+        // the contents changed under the translations cached for the page - they have to take
+        // the page again, so a write through them marks it dirty
+        invalidate_extent(frames[frame].page);
+        frameVersions[frame]++;
+        mappingEpoch++;
+        return true;
+    }
+
+    invalidate_extent(frames[frame].page);
+    mappingEpoch++;
+    if (frame != last) {
+        if (frames[last].isLeaf) {
+            invalidate_extent(frames[last].page);
+        }
+        swap_frames(frame, last);
+        frame = last;
+    }
+
+    uint64_t parentEntry = frames[frame].parentEntry;
+    PMwrite(parentEntry, 0);
+    unlink_summaries((word_t) (parentEntry / PAGE_SIZE), frame);
+    regions[region_of(frames[frame].page)].stats.frames--;
+    remove_resident(frame);
+    frameVersions[frame]++;
+    usedFrames--;
+
+#ifdef VM_EVICTION_SAMPLES
+    // the page may have been the last one in its table
+    remember_empty_table((word_t) (parentEntry / PAGE_SIZE));
+#endif
+    return true;
+}
+
+
+/**
+ * Drops the contents of a page - from the physical memory and from the swap
+ *
+ * @param pageNumber The virtual page number
+ * @return True if the page was dropped, false if it is pinned
+ */
+bool discard_page(uint64_t pageNumber) {
+    word_t frame = find_resident_frame(pageNumber);
+    if (frame != 0) {
+        return drop_resident_page(frame);
+    }
+
+    // restoring the page removes its copy from the swap
+    if (is_swapped(pageNumber)) {
+        uint64_t borrowedPage;
+        word_t scratch = acquire_scratch_frame(&borrowedPage);
+        if (scratch == 0) {
+            return false;
+        }
+
+        restore_page(scratch, pageNumber);
+        release_scratch_frame(scratch, borrowedPage);
+    }
+    return true;
+}
+
+
+/**
+ * Drops the contents of numPages pages starting at the page of the given virtual address, without
+ * writing them to the swap - their frames and swap copies are freed. The contents of a discarded
+ * page are undefined until it is written (zeros with VM_DROP_CLEAN_PAGES). Pinned pages are kept,
+ * and while the last frame in use is pinned a discarded page keeps its frame.
+ *
+ * returns 1 on success.
+ * returns 0 if the range exceeds the virtual memory or a page was kept
+ */
+int VMdiscard(uint64_t virtualAddress, uint64_t numPages) {
+    uint64_t firstPage = virtualAddress >> OFFSET_WIDTH;
+    if (virtualAddress >= VIRTUAL_MEMORY_SIZE || numPages > NUM_PAGES - firstPage) {
+        return 0;
+    }
+
+    int discarded = 1;
+    for (uint64_t page = firstPage; page < firstPage + numPages; page++) {
+        if (!discard_page(page)) {
+            discarded = 0;
+        }
+    }
+
+    count_operation();
+    return discarded;
+}
+
+
+/**
+ * Finds the first set bit of a bitmap
+ *
+ * @param bitmap The bitmap
+ * @param bits The number of bits in the bitmap
+ * @return The index of the bit, or bits if no bit is set
+ */
+uint64_t first_set_bit(const uint64_t* bitmap, uint64_t bits) {
+    for (uint64_t word = 0; word < (bits + 63) / 64; word++) {
+        if (bitmap[word] != 0) {
+            uint64_t bit = word * 64 + __builtin_ctzll(bitmap[word]);
+            return bit < bits ? bit : bits;
+        }
+    }
+    return bits;
+}
+
+
+/**
+ * Finds the first clear bit of a bitmap
+ *
+ * @param bitmap The bitmap
+ * @param bits The number of bits in the bitmap
+ * @return The index of the bit, or bits if every bit is set
+ */
+uint64_t first_clear_bit(const uint64_t* bitmap, uint64_t bits) {
+    for (uint64_t word = 0; word < (bits + 63) / 64; word++) {
+        if (~bitmap[word] != 0) {
+            uint64_t bit = word * 64 + __builtin_ctzll(~bitmap[word]);
+            return bit < bits ? bit : bits;
+        }
+    }
+    return bits;
+}
+
+
+/**
+ * Sets or clears a bit of a bitmap
+ *
+ * @param bitmap The bitmap
+ * @param bit The index of the bit
+ * @param set True to set the bit, false to clear it
+ */
+void update_bit(uint64_t* bitmap, uint64_t bit, bool set) {
+    if (set) {
+        bitmap[bit / 64] |= (uint64_t) 1 << (bit % 64);
+    }
+    else {
+        bitmap[bit / 64] &= ~((uint64_t) 1 << (bit % 64));
+    }
+}
+
+
+/**
+ * Checks a bit of a bitmap
+ *
+ * @param bitmap The bitmap
+ * @param bit The index of the bit
+ * @return True if the bit is set
+ */
+bool test_bit(const uint64_t* bitmap, uint64_t bit) {
+    return (bitmap[bit / 64] >> (bit % 64)) & 1;
+}
+
+
+/**
+ * Finds the first run of free pages of the heap
+ *
+ * @param numPages The length of the run
+ * @return The first page of the run, or NUM_PAGES if there is none
+ */
+uint64_t find_free_pages(uint64_t numPages) {
+    uint64_t runStart = 0;
+
+    for (uint64_t page = 0; page < NUM_PAGES; page++) {
+        if (test_bit(heap->usedPages, page)) {
+            runStart = page + 1;
+        }
+        else if (page + 1 - runStart == numPages) {
+            return runStart;
+        }
+    }
+    return NUM_PAGES;
+}
+
+
+/**
+ * Gives a page of the heap to an allocation
+ *
+ * @param page The page
+ * @param kind The kind of the page (size class + 1, HEAP_LARGE or HEAP_LARGE_TAIL)
+ * @param slots The bitmap of the slots of a slab, or null
+ */
+void take_heap_page(uint64_t page, uint8_t kind, uint64_t* slots) {
+    heap->pages[page] = {kind, 0, slots};
+    update_bit(heap->usedPages, page, true);
+}
+
+
+/**
+ * Returns a page to the heap, and drops its contents
+ *
+ * @param page The page
+ * @return True if the contents were dropped, false if the page is pinned and kept them
+ */
+bool free_heap_page(uint64_t page) {
+    free(heap->pages[page].slots);
+    heap->pages[page] = {HEAP_FREE, 0, nullptr};
+    update_bit(heap->usedPages, page, false);
+    return discard_page(page);
+}
+
+
+/**
+ * Allocates words consecutive words in the virtual memory. Small allocations share pages with
+ * allocations of the same size class, packed into the lowest pages, and larger allocations take
+ * whole pages - so the live objects take as few pages as possible.
+ *
+ * returns 1 on success, and puts the virtual address of the allocation in *virtualAddress.
+ * returns 0 if words is 0, the virtual memory has no room for the allocation or the bookkeeping
+ * of the heap could not be allocated
+ */
+int VMalloc(uint64_t words, uint64_t* virtualAddress) {
+    if (words == 0) {
+        return 0;
+    }
+
+    if (heap == nullptr) {
+        heap = (Heap*) calloc(1, sizeof(Heap));
+        if (heap == nullptr) {
+            return 0;
+        }
+    }
+
+    // whole pages
+    if (words > PAGE_SIZE / 2) {
+        uint64_t numPages = (words + PAGE_SIZE - 1) / PAGE_SIZE;
+        uint64_t first = numPages <= NUM_PAGES ? find_free_pages(numPages) : NUM_PAGES;
+        if (first == NUM_PAGES) {
+            return 0;
+        }
+
+        take_heap_page(first, HEAP_LARGE, nullptr);
+        heap->pages[first].count = numPages;
+        for (uint64_t page = first + 1; page < first + numPages; page++) {
+            take_heap_page(page, HEAP_LARGE_TAIL, nullptr);
+        }
+
+        *virtualAddress = first * PAGE_SIZE;
+        return 1;
+    }
+
+    // a slot in the lowest slab of the size class that has a free slot
+    int sizeClass = 0;
+    while (((uint64_t) 1 << sizeClass) < words) {
+        sizeClass++;
+    }
+
+    uint64_t slotsPerSlab = PAGE_SIZE >> sizeClass;
+    uint64_t page = first_set_bit(heap->partialSlabs[sizeClass], NUM_PAGES);
+    if (page == NUM_PAGES) {
+        page = find_free_pages(1);
+        if (page == NUM_PAGES) {
+            return 0;
+        }
+        uint64_t* slots = (uint64_t*) calloc((slotsPerSlab + 63) / 64, sizeof(uint64_t));
+        if (slots == nullptr) {
+            return 0;
+        }
+        take_heap_page(page, (uint8_t) (sizeClass + 1), slots);
+        update_bit(heap->partialSlabs[sizeClass], page, true);
+    }
+
+    HeapPage* slab = &heap->pages[page];
+    uint64_t slot = first_clear_bit(slab->slots, slotsPerSlab);
+    update_bit(slab->slots, slot, true);
+    if (++slab->count == slotsPerSlab) {
+        update_bit(heap->partialSlabs[sizeClass], page, false);
+    }
+
+    *virtualAddress = page * PAGE_SIZE + (slot << sizeClass);
+    return 1;
+}
+
+
+/**
+ * Frees an allocation of VMalloc. Pages that no longer hold an allocation are discarded, so they
+ * take no frame and no room in the swap. The allocation is freed even if one of its pages is
+ * pinned, but the pinned page keeps its contents (as with VMdiscard).
+ *
+ * returns 1 on success.
+ * returns 0 if the address is not the start of an allocation or a pinned page was kept
+ */
+int VMfree(uint64_t virtualAddress) {
+    if (heap == nullptr || virtualAddress >= VIRTUAL_MEMORY_SIZE) {
+        return 0;
+    }
+
+    uint64_t page = virtualAddress >> OFFSET_WIDTH;
+    uint64_t offset = virtualAddress & (PAGE_SIZE - 1);
+    HeapPage* entry = &heap->pages[page];
+    int discarded = 1;
+
+    if (entry->kind == HEAP_LARGE) {
+        if (offset != 0) {
+            return 0;
+        }
+
+        uint64_t numPages = entry->count;
+        for (uint64_t i = 0; i < numPages; i++) {
+            if (!free_heap_page(page + i)) {
+                discarded = 0;
+            }
+        }
+        count_operation();
+        return discarded;
+    }
+
+    // a slot of a slab - the address must be the start of a slot in use
+    if (entry->kind == HEAP_FREE || entry->kind == HEAP_LARGE_TAIL) {
+        return 0;
+    }
+    int sizeClass = entry->kind - 1;
+    uint64_t slot = offset >> sizeClass;
+    if ((slot << sizeClass) != offset || !test_bit(entry->slots, slot)) {
         return 0;
     }
 
-    if ((virtualAddress >> OFFSET_WIDTH) >= NUM_PAGES) {
+    update_bit(entry->slots, slot, false);
+    update_bit(heap->partialSlabs[sizeClass], page, true);
+
+    // the slab is empty
+    if (--entry->count == 0) {
+        update_bit(heap->partialSlabs[sizeClass], page, false);
+        if (!free_heap_page(page)) {
+            discarded = 0;
+        }
+    }
+
+    count_operation();
+    return discarded;
+}
+
+
+// operations of modify_word
+#define MODIFY_ADD 0  // add the operand to the word
+#define MODIFY_EXCHANGE 1  // replace the word with the operand
+#define MODIFY_COMPARE_EXCHANGE 2  // replace the word with the operand if it equals the expected
+
+
+/**
+ * Reads a word and writes its new value with a single translation - no other access to the
+ * virtual memory (and so no eviction of the page) comes between the read and the write
+ *
+ * @param virtualAddress The virtual address
+ * @param operation The MODIFY_* operation
+ * @param operand The operand of the operation
+ * @param expected The expected value of the word (MODIFY_COMPARE_EXCHANGE)
+ * @param previous Output - the value of the word before the operation
+ * @return 1 on success, 0 if the address is invalid or the page could not be mapped
+ */
+int modify_word(uint64_t virtualAddress, int operation, word_t operand, word_t expected,
+                word_t* previous) {
+    if (!is_valid_address(virtualAddress)) {
         return 0;
     }
 
     uint64_t offsets[TABLES_DEPTH + 1];
     init_offsets(virtualAddress, offsets);
+    uint64_t frame = find_physical_address(virtualAddress, offsets, false);
+    if (frame == 0) {
+        return 0;
+    }
+    uint64_t physicalAddress = frame * PAGE_SIZE + offsets[TABLES_DEPTH];
 
-    uint64_t physical_address = find_physical_address(virtualAddress, offsets);
-    PMwrite(physical_address * PAGE_SIZE + offsets[TABLES_DEPTH], value);
+    word_t value;
+    PMread(physicalAddress, &value);
+    *previous = value;
+
+    if (operation == MODIFY_ADD) {
+        value = (word_t) ((uint64_t) value + (uint64_t) operand);
+    }
+    else if (operation == MODIFY_EXCHANGE || value == expected) {
+        value = operand;
+    }
 
+    if (value != *previous) {
+        PMwrite(physicalAddress, value);
+        record_write(frame);
+    }
+
+    release_frame(frame, virtualAddress >> OFFSET_WIDTH);
+    count_operation();
     return 1;
-}
\ No newline at end of file
+}
+
+
+/**
+ * Adds delta to the word at the given virtual address (wrapping around on overflow), and puts
+ * the value before the addition in *previous.
+ *
+ * returns 1 on success.
+ * returns 0 if the address is invalid or the page could not be mapped
+ */
+int VMfetchAdd(uint64_t virtualAddress, word_t delta, word_t* previous) {
+    return modify_word(virtualAddress, MODIFY_ADD, delta, 0, previous);
+}
+
+
+/**
+ * Replaces the word at the given virtual address with value, and puts the value it replaced in
+ * *previous.
+ *
+ * returns 1 on success.
+ * returns 0 if the address is invalid or the page could not be mapped
+ */
+int VMexchange(uint64_t virtualAddress, word_t value, word_t* previous) {
+    return modify_word(virtualAddress, MODIFY_EXCHANGE, value, 0, previous);
+}
+
+
+/**
+ * Replaces the word at the given virtual address with desired if it equals expected, and puts
+ * the value it had in *previous - the word was replaced if *previous == expected.
+ *
+ * returns 1 on success.
+ * returns 0 if the address is invalid or the page could not be mapped
+ */
+int VMcompareExchange(uint64_t virtualAddress, word_t expected, word_t desired,
+                      word_t* previous) {
+    return modify_word(virtualAddress, MODIFY_COMPARE_EXCHANGE, desired, expected, previous);
+}
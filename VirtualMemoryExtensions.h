@@ -0,0 +1,422 @@
+//
+// Extensions to the VirtualMemory.h API.
+//
+
+#pragma once
+
+#include "MemoryConstants.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <iterator>
+
+
+/**
+ * Paging counters collected since VMinitialize
+ */
+struct VMstats {
+    uint64_t faults;  // pages that were mapped to a frame
+    uint64_t evictions;  // pages that were evicted to make room for another page
+    uint64_t framesScanned;  // frames examined while searching for a frame to use
+    uint64_t victimDistanceSum;  // sum of the cyclic distances of the evicted pages
+    uint64_t bounced;  // accesses served through the bounce frame without being mapped
+    uint64_t readAhead;  // pages restored after a faulted page (VM_SWAP_READAHEAD)
+    uint64_t cleanDrops;  // evictions of pages never written, not written to the swap
+    uint64_t zeroReads;  // words of unwritten pages read without mapping them (VM_ZERO_PAGE_READS)
+};
+
+
+/**
+ * Counters of a tier of frames (VM_FAST_FRAMES) - accesses / the accesses of all the tiers is the
+ * hit rate of the tier
+ */
+struct VMtierStats {
+    uint64_t accesses;  // accesses to pages stored in the tier
+    uint64_t faults;  // pages that were mapped to a frame of the tier
+    uint64_t pagesIn;  // pages moved to the tier from the other tier (promoted or demoted)
+};
+
+
+/**
+ * Layout of the pages in the swap - the swap is ordered by page number, so restoring a range of
+ * pages takes one sequential read for every run of consecutive pages
+ */
+struct VMswapStats {
+    uint64_t pages;  // pages that have a copy in the swap
+    uint64_t runs;  // runs of consecutive pages in the swap (runs / pages is the fragmentation)
+};
+
+
+/**
+ * Frame usage and paging counters of a region - the part of the virtual memory mapped by one
+ * entry of the root table
+ */
+struct VMregionStats {
+    uint64_t frames;  // frames used by the region (its tables and pages)
+    uint64_t faults;  // pages of the region that were mapped to a frame
+    uint64_t evictions;  // pages of the region that were evicted
+};
+
+
+/**
+ * Reads count words from the given virtual addresses into values, translating each virtual
+ * page once, in any order of the addresses.
+ *
+ * returns 1 on success.
+ * returns 0 if any of the addresses is invalid (nothing is read in that case) or a page could
+ * not be mapped
+ */
+int VMreadBatch(const uint64_t* virtualAddresses, word_t* values, uint64_t count);
+
+
+/**
+ * Reads count consecutive words starting at the given virtual address into values. With
+ * VM_STREAMING_READS, pages that are not in the physical memory are read without being mapped.
+ *
+ * returns 1 on success.
+ * returns 0 if the range exceeds the virtual memory (nothing is read in that case) or a page
+ * could not be mapped
+ */
+int VMreadRange(uint64_t virtualAddress, word_t* values, uint64_t count);
+
+
+/**
+ * Relocates frames so the resident pages of the given virtual range are stored in consecutive
+ * frames, moving at most maxMoves frames.
+ *
+ * returns the number of frames that were relocated.
+ */
+uint64_t VMcompact(uint64_t virtualAddress, uint64_t numPages, uint64_t maxMoves);
+
+
+/**
+ * Copies the paging counters collected since VMinitialize into *stats.
+ *
+ * victimDistanceSum / evictions is the average cyclic distance of the evicted pages, which shows
+ * how close a bounded victim search (VM_VICTIM_SEARCH_BUDGET) gets to the exact search.
+ */
+void VMgetStats(VMstats* stats);
+
+
+/**
+ * Sets the minimal and maximal (0 for no limit) number of frames of a region - the part of the
+ * virtual memory mapped by one entry of the root table. A region at its maximum evicts its own
+ * pages - if they are all pinned, its faults fail (accesses return 0), or go through the bounce
+ * frame with VM_ADMISSION_FILTER or VM_STREAMING_READS.
+ *
+ * returns 1 on success.
+ * returns 0 if the region does not exist or the quota is invalid
+ */
+int VMsetRegionQuota(uint64_t region, uint64_t minFrames, uint64_t maxFrames);
+
+
+/**
+ * Copies the frame usage and paging counters of a region into *stats.
+ *
+ * returns 1 on success.
+ * returns 0 if the region does not exist
+ */
+int VMgetRegionStats(uint64_t region, VMregionStats* stats);
+
+
+/**
+ * Returns the mapping epoch - it changes whenever a page is unmapped or moved to another frame,
+ * before that frame is reused.
+ */
+uint64_t VMgetMappingEpoch();
+
+
+/**
+ * Pins the page of the given virtual address - it stays in the same frame (it is neither evicted
+ * nor moved) until it is unpinned. At most VM_HAZARD_SLOTS pages are pinned at the same time.
+ *
+ * returns 1 on success.
+ * returns 0 if the address is invalid, too many pages are pinned or the page could not be mapped
+ */
+int VMpin(uint64_t virtualAddress);
+
+
+/**
+ * Unpins the page of the given virtual address (once for every time it was pinned).
+ *
+ * returns 1 on success.
+ * returns 0 if the page is not pinned
+ */
+int VMunpin(uint64_t virtualAddress);
+
+
+/**
+ * Writes the pages that hold data (resident pages and pages in the swap) to the file, in page
+ * order, without mapping any page or changing the eviction order. Pages in the swap are read
+ * through a spare frame - without a bounce frame and with every frame in use, a resident page is
+ * written to the swap and restored for each of them. The image is little-endian: a header (the magic
+ * "VMSP", the word size in bytes as 4 bytes each, then PAGE_SIZE and NUM_PAGES as 8 bytes each)
+ * followed by a record for every page (the page number as 8 bytes, then PAGE_SIZE words).
+ *
+ * returns 1 on success.
+ * returns 0 if writing the file failed or a page in the swap could not be read
+ */
+int VMexport(FILE* file);
+
+
+/**
+ * Reads an image written by VMexport into the virtual memory, without mapping any page or
+ * changing the eviction order. Pages that are not resident are written to the swap through a
+ * spare frame, at the same cost as in VMexport. Pages that are not in the image keep their
+ * contents.
+ *
+ * returns 1 on success.
+ * returns 0 if the file is not an image of this virtual memory or it is truncated
+ */
+int VMimport(FILE* file);
+
+
+/**
+ * Copies the layout of the pages in the swap into *stats.
+ */
+void VMgetSwapStats(VMswapStats* stats);
+
+
+/**
+ * Copies the counters of a tier into *stats - tier 0 is the fast tier (frames below
+ * VM_FAST_FRAMES) and tier 1 is the slow tier. Without VM_FAST_FRAMES there is only tier 0.
+ *
+ * returns 1 on success.
+ * returns 0 if the tier does not exist
+ */
+int VMgetTierStats(uint64_t tier, VMtierStats* stats);
+
+
+/**
+ * Checks that the tables and the bookkeeping of the frames agree - every entry points to a frame
+ * in use other than the root, no frame is pointed to twice, the pages match the reverse map and
+ * the caches translate only what the tables map. The check reads every table once. With
+ * VM_CHECK_INTERVAL=n it also runs after every n operations (reads, writes, compactions,
+ * discards and the other calls that access pages), and aborts if it fails.
+ *
+ * returns 1 if the tables are consistent.
+ * returns 0 otherwise
+ */
+int VMcheckConsistency();
+
+
+/**
+ * Translates a virtual address to the physical address of its word, mapping the page if needed.
+ * Resident data can then be accessed with PMread/PMwrite directly, without a table walk, for as
+ * long as VMgetMappingEpoch returns the same value or the page is pinned. Pass writable = 1 if
+ * the word will be written through the physical address.
+ *
+ * returns 1 on success.
+ * returns 0 if the address is invalid or the page could not be mapped
+ */
+int VMtranslate(uint64_t virtualAddress, int writable, uint64_t* physicalAddress);
+
+
+/**
+ * Position in the virtual memory that keeps the translation of its page, so accesses that stay on
+ * the same page skip the table walk. The translation is dropped when the frame is reused for
+ * another mapping.
+ */
+struct VMcursor {
+    uint64_t address;  // the virtual address of the cursor
+    uint64_t page;  // the page of the cached translation (NUM_PAGES if there is none)
+    uint64_t frame;  // the frame of the page
+    uint64_t version;  // the version of the frame when it was translated
+    bool writable;  // whether the page was translated for writing
+};
+
+
+/**
+ * Places a cursor at the given virtual address.
+ */
+void VMcursorInit(VMcursor* cursor, uint64_t virtualAddress);
+
+
+/**
+ * Moves a cursor by the given number of words - forward, backward (negative) or by a stride.
+ */
+void VMcursorMove(VMcursor* cursor, int64_t words);
+
+
+/**
+ * Reads the word at the cursor into *value.
+ *
+ * returns 1 on success.
+ * returns 0 if the address of the cursor is invalid or its page could not be mapped
+ */
+int VMcursorRead(VMcursor* cursor, word_t* value);
+
+
+/**
+ * Writes a word at the cursor.
+ *
+ * returns 1 on success.
+ * returns 0 if the address of the cursor is invalid or its page could not be mapped
+ */
+int VMcursorWrite(VMcursor* cursor, word_t value);
+
+
+/**
+ * Reference to a word of the virtual memory, returned by VMiterator
+ */
+class VMreference {
+public:
+    explicit VMreference(VMcursor* cursor) : cursor(cursor) {}
+
+    operator word_t() const {
+        word_t value = 0;
+        VMcursorRead(cursor, &value);
+        return value;
+    }
+
+    VMreference& operator=(word_t value) {
+        VMcursorWrite(cursor, value);
+        return *this;
+    }
+
+    VMreference& operator=(const VMreference& other) {
+        return *this = (word_t) other;
+    }
+
+    // the references point to the words, so swapping them swaps the words
+    friend void swap(VMreference a, VMreference b) {
+        word_t value = a;
+        a = (word_t) b;
+        b = value;
+    }
+
+private:
+    VMcursor* cursor;
+};
+
+
+/**
+ * Random access iterator over the words of the virtual memory, for the standard algorithms. It
+ * is built on a VMcursor, so walking it over a range translates every page once.
+ */
+class VMiterator {
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = word_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = VMreference;
+
+    VMiterator() : VMiterator(0) {}
+
+    explicit VMiterator(uint64_t virtualAddress) {
+        VMcursorInit(&cursor, virtualAddress);
+    }
+
+    uint64_t address() const { return cursor.address; }
+
+    reference operator*() { return VMreference(&cursor); }
+
+    // the word at an offset is read through a copy of the cursor, so it is returned by value
+    value_type operator[](difference_type offset) const { return *(*this + offset); }
+
+    VMiterator& operator+=(difference_type words) {
+        VMcursorMove(&cursor, words);
+        return *this;
+    }
+
+    VMiterator& operator-=(difference_type words) { return *this += -words; }
+    VMiterator& operator++() { return *this += 1; }
+    VMiterator& operator--() { return *this -= 1; }
+
+    VMiterator operator++(int) {
+        VMiterator previous = *this;
+        ++*this;
+        return previous;
+    }
+
+    VMiterator operator--(int) {
+        VMiterator previous = *this;
+        --*this;
+        return previous;
+    }
+
+    VMiterator operator+(difference_type words) const { return VMiterator(*this) += words; }
+    VMiterator operator-(difference_type words) const { return VMiterator(*this) -= words; }
+
+    friend VMiterator operator+(difference_type words, const VMiterator& it) { return it + words; }
+
+    difference_type operator-(const VMiterator& other) const {
+        return (difference_type) (cursor.address - other.cursor.address);
+    }
+
+    bool operator==(const VMiterator& other) const { return address() == other.address(); }
+    bool operator!=(const VMiterator& other) const { return address() != other.address(); }
+    bool operator<(const VMiterator& other) const { return address() < other.address(); }
+    bool operator>(const VMiterator& other) const { return address() > other.address(); }
+    bool operator<=(const VMiterator& other) const { return address() <= other.address(); }
+    bool operator>=(const VMiterator& other) const { return address() >= other.address(); }
+
+private:
+    VMcursor cursor;
+};
+
+
+/**
+ * Drops the contents of numPages pages starting at the page of the given virtual address, freeing
+ * their frames and their copies in the swap without writing anything. The contents of a
+ * discarded page are undefined until it is written (zeros with VM_DROP_CLEAN_PAGES). Pinned pages
+ * are kept, and while the last frame in use is pinned a discarded page keeps its frame.
+ *
+ * returns 1 on success.
+ * returns 0 if the range exceeds the virtual memory or a pinned page was kept
+ */
+int VMdiscard(uint64_t virtualAddress, uint64_t numPages);
+
+
+/**
+ * Allocates words consecutive words in the virtual memory. Allocations of up to PAGE_SIZE / 2
+ * words share pages with allocations of the same size class, and larger ones take whole pages.
+ * The contents of a new allocation are undefined.
+ *
+ * returns 1 on success, and puts the virtual address of the allocation in *virtualAddress.
+ * returns 0 if words is 0, there is no room for the allocation or the bookkeeping of the heap
+ * could not be allocated
+ */
+int VMalloc(uint64_t words, uint64_t* virtualAddress);
+
+
+/**
+ * Frees an allocation of VMalloc. Pages left without allocations are discarded - a pinned page
+ * keeps its contents, but the allocation is freed anyway.
+ *
+ * returns 1 on success.
+ * returns 0 if the address is not the start of an allocation or a pinned page was kept
+ */
+int VMfree(uint64_t virtualAddress);
+
+
+/**
+ * Adds delta to the word at the given virtual address (wrapping around on overflow), and puts
+ * the value before the addition in *previous. The word is read and written with one translation,
+ * and nothing is evicted in between.
+ *
+ * returns 1 on success.
+ * returns 0 if the address is invalid or the page could not be mapped
+ */
+int VMfetchAdd(uint64_t virtualAddress, word_t delta, word_t* previous);
+
+
+/**
+ * Replaces the word at the given virtual address with value, and puts the value it replaced in
+ * *previous.
+ *
+ * returns 1 on success.
+ * returns 0 if the address is invalid or the page could not be mapped
+ */
+int VMexchange(uint64_t virtualAddress, word_t value, word_t* previous);
+
+
+/**
+ * Replaces the word at the given virtual address with desired if it equals expected, and puts
+ * the value it had in *previous - the word was replaced if *previous == expected.
+ *
+ * returns 1 on success.
+ * returns 0 if the address is invalid or the page could not be mapped
+ */
+int VMcompareExchange(uint64_t virtualAddress, word_t expected, word_t desired, word_t* previous);
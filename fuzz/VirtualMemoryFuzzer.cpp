@@ -0,0 +1,742 @@
+//
+// Fuzzing target of the virtual memory, for libFuzzer or AFL.
+//
+// Every input is run twice, each time from an empty virtual memory:
+// - as reads and writes only, on this implementation and on the original one
+//   (OriginalVirtualMemory.inc, the implementation the extensions were built on). Both must return
+//   the same values and evict and restore the same pages in the same frames. This run is skipped
+//   when the build changes the order of the evictions (see FUZZ_DIFFERENTIAL).
+// - as operations of the whole API, checked against the words known to be in the virtual memory
+//   and against VMcheckConsistency.
+// A mismatch aborts, so the fuzzer keeps the input that caused it.
+//
+// The target provides the physical memory (PMread, PMwrite, PMevict and PMrestore), so it is built
+// in place of PhysicalMemory.cpp, from the directory of VirtualMemory.cpp:
+//
+//   libFuzzer: clang++ -g -O1 -fsanitize=fuzzer,address,undefined -I. -I<course headers>
+//              fuzz/VirtualMemoryFuzzer.cpp VirtualMemory.cpp
+//   AFL:       afl-clang-fast++ -g -O1 -DVM_FUZZ_MAIN -I. -I<course headers>
+//              fuzz/VirtualMemoryFuzzer.cpp VirtualMemory.cpp
+//
+// fuzz/corpus holds seed inputs for the cases random inputs rarely reach - pass it to the fuzzer
+// as its corpus directory (quota_pin: a region at its maximum whose only page is pinned faults).
+//
+// With VM_FUZZ_MAIN the target runs the files given as arguments (or the standard input), so a
+// crashing input can be replayed by any build. The original implementation only compiles with
+// int words - define VM_FUZZ_NO_ORIGINAL to leave it out of builds with other words.
+//
+
+#include "VirtualMemory.h"
+#include "VirtualMemoryExtensions.h"
+#include "PhysicalMemory.h"
+
+#include <array>
+#include <cstdio>
+#include <iterator>
+#include <cstdlib>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+// the eviction order only matches the original without the options that choose other victims,
+// skip evictions or keep frames out of the tree
+#if defined(VM_VICTIM_SEARCH_BUDGET) || defined(VM_EVICTION_SAMPLES) || \
+    defined(VM_ADMISSION_FILTER) || defined(VM_STREAMING_READS) || defined(VM_FAST_FRAMES) || \
+    defined(VM_SWAP_READAHEAD) || defined(VM_DROP_CLEAN_PAGES) || defined(VM_ZERO_PAGE_READS) || \
+    defined(VM_FUZZ_NO_ORIGINAL)
+#define FUZZ_DIFFERENTIAL 0
+#else
+#define FUZZ_DIFFERENTIAL 1
+#endif
+
+// pages that were never written hold zeros (otherwise their contents are undefined)
+#if defined(VM_DROP_CLEAN_PAGES) || defined(VM_ZERO_PAGE_READS) || \
+    defined(VM_ADMISSION_FILTER) || defined(VM_STREAMING_READS)
+#define FUZZ_ZERO_FILLED
+#endif
+
+// operations of the second run, selected by the opcode byte modulo FUZZ_OPS
+#define FUZZ_READ 0  // address (4 bytes)
+#define FUZZ_WRITE 1  // address (4 bytes), value (4 bytes)
+#define FUZZ_READ_RANGE 2  // address (4 bytes), count (1 byte)
+#define FUZZ_READ_BATCH 3  // address (4 bytes), count (1 byte), then an offset (1 byte) per word
+#define FUZZ_COMPACT 4  // address (4 bytes), pages (1 byte), maximal moves (1 byte)
+#define FUZZ_PIN 5  // address (4 bytes)
+#define FUZZ_UNPIN 6  // address (4 bytes)
+#define FUZZ_CHECK 7  // no operands
+#define FUZZ_DISCARD 8  // address (4 bytes), pages (1 byte)
+#define FUZZ_CURSOR_SEEK 9  // address (4 bytes)
+#define FUZZ_CURSOR_READ 10  // move (1 signed byte)
+#define FUZZ_CURSOR_WRITE 11  // move (1 signed byte), value (4 bytes)
+#define FUZZ_FETCH_ADD 12  // address (4 bytes), delta (4 bytes)
+#define FUZZ_COMPARE_EXCHANGE 13  // address (4 bytes), flag (1 byte), expected and desired (4 bytes)
+#define FUZZ_QUOTA 14  // region (1 byte), minimal and maximal frames (2 bytes each)
+#define FUZZ_ALLOC 15  // words (2 bytes)
+#define FUZZ_FREE 16  // allocation (1 byte), offset (1 byte)
+#define FUZZ_EXPORT 17  // address (4 bytes), pages (1 byte)
+#define FUZZ_TRANSLATE 18  // address (4 bytes), writable (1 byte), value (4 bytes)
+#define FUZZ_EXCHANGE 19  // address (4 bytes), value (4 bytes)
+#define FUZZ_OPS 20
+
+
+/**
+ * An eviction (restore = 0) or a restoration (restore = 1) - restore, frame, page
+ */
+typedef std::array<uint64_t, 3> PagingEvent;
+
+
+/**
+ * A physical memory - the RAM, the swap and the evictions and restorations since the last check
+ */
+struct PhysicalMemory {
+    std::vector<word_t> ram = std::vector<word_t>(NUM_FRAMES * PAGE_SIZE);
+    std::map<uint64_t, std::vector<word_t>> swap;
+    std::vector<PagingEvent> events;
+};
+
+
+/**
+ * Aborts with a message if a check failed
+ *
+ * @param passed The result of the check
+ * @param message What went wrong
+ */
+void fuzz_check(bool passed, const char* message) {
+    if (!passed) {
+        fprintf(stderr, "VirtualMemoryFuzzer: %s\n", message);
+        abort();
+    }
+}
+
+
+/**
+ * Reads a word of the RAM, like PMread
+ */
+void pm_read(PhysicalMemory* memory, uint64_t physicalAddress, word_t* value) {
+    fuzz_check(physicalAddress < (uint64_t) NUM_FRAMES * PAGE_SIZE, "read outside the RAM");
+    *value = memory->ram[physicalAddress];
+}
+
+
+/**
+ * Writes a word of the RAM, like PMwrite
+ */
+void pm_write(PhysicalMemory* memory, uint64_t physicalAddress, word_t value) {
+    fuzz_check(physicalAddress < (uint64_t) NUM_FRAMES * PAGE_SIZE, "wrote outside the RAM");
+    memory->ram[physicalAddress] = value;
+}
+
+
+/**
+ * Copies a frame to the swap, like PMevict - a page is never evicted twice without being restored
+ */
+void pm_evict(PhysicalMemory* memory, uint64_t frameIndex, uint64_t evictedPageIndex) {
+    fuzz_check(frameIndex < NUM_FRAMES && evictedPageIndex < NUM_PAGES,
+               "evicted an invalid frame or page");
+    fuzz_check(memory->swap.count(evictedPageIndex) == 0,
+               "evicted a page that is already in the swap");
+
+    auto frame = memory->ram.begin() + (int64_t) (frameIndex * PAGE_SIZE);
+    memory->swap[evictedPageIndex].assign(frame, frame + PAGE_SIZE);
+    memory->events.push_back({0, frameIndex, evictedPageIndex});
+}
+
+
+/**
+ * Copies a page from the swap to a frame and removes it from the swap, like PMrestore
+ */
+void pm_restore(PhysicalMemory* memory, uint64_t frameIndex, uint64_t restoredPageIndex) {
+    fuzz_check(frameIndex < NUM_FRAMES && restoredPageIndex < NUM_PAGES,
+               "restored an invalid frame or page");
+
+    // a page that is not in the swap is left as it is
+    auto page = memory->swap.find(restoredPageIndex);
+    if (page == memory->swap.end()) {
+        return;
+    }
+
+    std::copy(page->second.begin(), page->second.end(),
+              memory->ram.begin() + (int64_t) (frameIndex * PAGE_SIZE));
+    memory->swap.erase(page);
+    memory->events.push_back({1, frameIndex, restoredPageIndex});
+}
+
+
+/**
+ * Empties a physical memory - zeros in the RAM and nothing in the swap
+ */
+void pm_reset(PhysicalMemory* memory) {
+    std::fill(memory->ram.begin(), memory->ram.end(), 0);
+    memory->swap.clear();
+    memory->events.clear();
+}
+
+
+// the physical memory of this implementation
+PhysicalMemory memory;
+
+void PMread(uint64_t physicalAddress, word_t* value) {
+    pm_read(&memory, physicalAddress, value);
+}
+
+void PMwrite(uint64_t physicalAddress, word_t value) {
+    pm_write(&memory, physicalAddress, value);
+}
+
+void PMevict(uint64_t frameIndex, uint64_t evictedPageIndex) {
+    pm_evict(&memory, frameIndex, evictedPageIndex);
+}
+
+void PMrestore(uint64_t frameIndex, uint64_t restoredPageIndex) {
+    pm_restore(&memory, frameIndex, restoredPageIndex);
+}
+
+
+#if FUZZ_DIFFERENTIAL
+// the original implementation, with a physical memory of its own - its includes were already
+// included above, so only its code lands in the namespace
+namespace original {
+PhysicalMemory memory;
+
+void PMread(uint64_t physicalAddress, word_t* value) {
+    pm_read(&memory, physicalAddress, value);
+}
+
+void PMwrite(uint64_t physicalAddress, word_t value) {
+    pm_write(&memory, physicalAddress, value);
+}
+
+void PMevict(uint64_t frameIndex, uint64_t evictedPageIndex) {
+    pm_evict(&memory, frameIndex, evictedPageIndex);
+}
+
+void PMrestore(uint64_t frameIndex, uint64_t restoredPageIndex) {
+    pm_restore(&memory, frameIndex, restoredPageIndex);
+}
+
+#include "OriginalVirtualMemory.inc"
+}
+#endif
+
+
+/**
+ * A fuzzing input, read from the front
+ */
+struct Input {
+    const uint8_t* data;
+    size_t size;
+    size_t position;
+};
+
+
+/**
+ * Takes the next little-endian value of the input
+ *
+ * @param input The input
+ * @param bytes The size of the value in bytes
+ * @return The value (the missing bytes are zeros if the input ends)
+ */
+uint64_t next_value(Input* input, uint64_t bytes) {
+    uint64_t value = 0;
+    for (uint64_t i = 0; i < bytes && input->position < input->size; i++) {
+        value |= (uint64_t) input->data[input->position++] << (8 * i);
+    }
+    return value;
+}
+
+
+/**
+ * Takes the next address of the input - addresses up to a page past the end of the virtual
+ * memory, so invalid addresses are covered too
+ */
+uint64_t next_address(Input* input) {
+    return next_value(input, 4) % (uint64_t) (VIRTUAL_MEMORY_SIZE + PAGE_SIZE);
+}
+
+
+/**
+ * Brings the virtual memory (and the original one) to the state of a new process - nothing mapped
+ * and nothing in the swap, whatever the previous input left behind
+ */
+void reset_memories() {
+    // the quotas are kept across VMinitialize
+    for (uint64_t region = 0; region < PAGE_SIZE; region++) {
+        VMsetRegionQuota(region, 0, 0);
+    }
+
+    // the copies left in the swap are discarded first, so the implementation stops expecting them
+    VMinitialize();
+    std::vector<uint64_t> swappedPages;
+    for (auto& page : memory.swap) {
+        swappedPages.push_back(page.first);
+    }
+    for (uint64_t page : swappedPages) {
+        fuzz_check(VMdiscard(page * PAGE_SIZE, 1) == 1, "could not discard a page in the swap");
+    }
+    fuzz_check(memory.swap.empty(), "discarded pages were left in the swap");
+
+    pm_reset(&memory);
+    VMinitialize();
+
+#if FUZZ_DIFFERENTIAL
+    pm_reset(&original::memory);
+    original::VMinitialize();
+#endif
+}
+
+
+#if FUZZ_DIFFERENTIAL
+/**
+ * Runs the input as reads and writes on both implementations, and checks that they return the
+ * same values and page in the same way
+ *
+ * @param input The input
+ */
+void run_differential(Input* input) {
+    while (input->position < input->size) {
+        uint8_t opcode = input->data[input->position++];
+        uint64_t address = next_address(input);
+
+        if (opcode % 2 == 0) {
+            word_t value = 0;
+            word_t originalValue = 0;
+            int result = VMread(address, &value);
+            fuzz_check(result == original::VMread(address, &originalValue),
+                       "VMread succeeded where the original failed, or the other way around");
+            fuzz_check(result == 0 || value == originalValue,
+                       "VMread returned another value than the original");
+        }
+        else {
+            auto value = (word_t) next_value(input, 4);
+            fuzz_check(VMwrite(address, value) == original::VMwrite(address, value),
+                       "VMwrite succeeded where the original failed, or the other way around");
+        }
+
+        fuzz_check(memory.events == original::memory.events,
+                   "evicted or restored other pages or frames than the original");
+        memory.events.clear();
+        original::memory.events.clear();
+    }
+}
+#endif
+
+
+// the words known to be in the virtual memory - written, or read once if their contents are
+// undefined
+std::unordered_map<uint64_t, word_t> knownWords;
+
+// the pinned pages, and how many times each of them is pinned
+std::map<uint64_t, uint64_t> pinnedPages;
+
+// the allocations of VMalloc that were not freed, and their sizes in words
+std::map<uint64_t, uint64_t> allocations;
+
+// the allocations on each page of the heap - a page is discarded when its last one is freed
+std::map<uint64_t, uint64_t> heapPages;
+
+// whether a region has a quota - with a quota, a fault may find no page it may evict, and a valid
+// access may fail
+bool quotasSet;
+
+
+/**
+ * Checks the result of an access to the virtual memory - an access to a valid address succeeds,
+ * unless the quotas leave no page to evict for it
+ *
+ * @param result The result of the access
+ * @param valid Whether the address is valid
+ * @param message What went wrong if the result is not expected
+ */
+void check_access(int result, bool valid, const char* message) {
+    fuzz_check(result == valid || (valid && quotasSet), message);
+}
+
+
+/**
+ * Checks a word read from the virtual memory against the known contents - the first read of a word
+ * whose contents are undefined tells what it holds
+ *
+ * @param virtualAddress The virtual address
+ * @param value The value read
+ */
+void check_word(uint64_t virtualAddress, word_t value) {
+    auto known = knownWords.find(virtualAddress);
+    if (known != knownWords.end()) {
+        fuzz_check(known->second == value, "read another value than the one last written");
+        return;
+    }
+
+#ifdef FUZZ_ZERO_FILLED
+    fuzz_check(value == 0, "read a value other than zero from a word that was never written");
+#endif
+    knownWords[virtualAddress] = value;
+}
+
+
+/**
+ * Forgets the contents of the pages that a discard of the given range dropped
+ *
+ * @param virtualAddress The virtual address of the first page
+ * @param numPages The number of pages
+ * @return Whether the discard is expected to succeed - the range is valid and no page is pinned
+ */
+bool forget_pages(uint64_t virtualAddress, uint64_t numPages) {
+    uint64_t firstPage = virtualAddress >> OFFSET_WIDTH;
+    if (virtualAddress >= VIRTUAL_MEMORY_SIZE || numPages > NUM_PAGES - firstPage) {
+        return false;
+    }
+
+    bool discarded = true;
+    for (uint64_t page = firstPage; page < firstPage + numPages; page++) {
+        if (pinnedPages.count(page) != 0) {
+            discarded = false;
+            continue;
+        }
+        for (uint64_t address = page * PAGE_SIZE; address < (page + 1) * PAGE_SIZE; address++) {
+            knownWords.erase(address);
+        }
+    }
+    return discarded;
+}
+
+
+/**
+ * Frees an allocation in the model of the heap, and forgets the contents of the pages left
+ * without allocations
+ *
+ * @param allocation The allocation
+ * @return Whether the free is expected to succeed - no page left without allocations is pinned
+ */
+bool forget_allocation(std::map<uint64_t, uint64_t>::iterator allocation) {
+    uint64_t firstPage = allocation->first >> OFFSET_WIDTH;
+    uint64_t lastPage = (allocation->first + allocation->second - 1) >> OFFSET_WIDTH;
+    allocations.erase(allocation);
+
+    bool discarded = true;
+    for (uint64_t page = firstPage; page <= lastPage; page++) {
+        if (--heapPages[page] == 0) {
+            heapPages.erase(page);
+            discarded = forget_pages(page * PAGE_SIZE, 1) && discarded;
+        }
+    }
+    return discarded;
+}
+
+
+/**
+ * Runs the input as operations of the whole API, and checks their results against the known
+ * contents of the virtual memory
+ *
+ * @param input The input
+ */
+void run_operations(Input* input) {
+    knownWords.clear();
+    pinnedPages.clear();
+    allocations.clear();
+    heapPages.clear();
+    quotasSet = false;
+    VMcursor cursor;
+    VMcursorInit(&cursor, 0);
+
+    while (input->position < input->size) {
+        uint64_t opcode = input->data[input->position++] % FUZZ_OPS;
+        word_t value;
+        word_t values[UINT8_MAX];
+        uint64_t addresses[UINT8_MAX];
+
+        if (opcode == FUZZ_READ) {
+            uint64_t address = next_address(input);
+            int result = VMread(address, &value);
+            check_access(result, address < VIRTUAL_MEMORY_SIZE, "VMread returned wrongly");
+            if (result) {
+                check_word(address, value);
+            }
+        }
+        else if (opcode == FUZZ_WRITE) {
+            uint64_t address = next_address(input);
+            value = (word_t) next_value(input, 4);
+            int result = VMwrite(address, value);
+            check_access(result, address < VIRTUAL_MEMORY_SIZE, "VMwrite returned wrongly");
+            if (result) {
+                knownWords[address] = value;
+            }
+        }
+        else if (opcode == FUZZ_READ_RANGE) {
+            uint64_t address = next_address(input);
+            uint64_t count = next_value(input, 1);
+            int result = VMreadRange(address, values, count);
+            check_access(result, address + count <= VIRTUAL_MEMORY_SIZE,
+                         "VMreadRange returned wrongly");
+            for (uint64_t i = 0; result && i < count; i++) {
+                check_word(address + i, values[i]);
+            }
+        }
+        else if (opcode == FUZZ_READ_BATCH) {
+            uint64_t address = next_address(input);
+            uint64_t count = next_value(input, 1);
+            bool valid = true;
+            for (uint64_t i = 0; i < count; i++) {
+                addresses[i] = address + next_value(input, 1);
+                valid = valid && addresses[i] < VIRTUAL_MEMORY_SIZE;
+            }
+            int result = VMreadBatch(addresses, values, count);
+            check_access(result, valid, "VMreadBatch returned wrongly");
+            for (uint64_t i = 0; result && i < count; i++) {
+                check_word(addresses[i], values[i]);
+            }
+        }
+        else if (opcode == FUZZ_COMPACT) {
+            uint64_t address = next_address(input);
+            uint64_t pages = next_value(input, 1);
+            fuzz_check(VMcompact(address, pages, next_value(input, 1)) <= pages,
+                       "VMcompact moved more frames than the range has pages");
+        }
+        else if (opcode == FUZZ_PIN) {
+            uint64_t address = next_address(input);
+            // a pin may fail when the hazard slots are taken or the page is not admitted
+            if (VMpin(address)) {
+                fuzz_check(address < VIRTUAL_MEMORY_SIZE, "VMpin pinned an invalid address");
+                pinnedPages[address >> OFFSET_WIDTH]++;
+            }
+        }
+        else if (opcode == FUZZ_UNPIN) {
+            uint64_t address = next_address(input);
+            auto pinned = pinnedPages.find(address >> OFFSET_WIDTH);
+            bool expected = address < VIRTUAL_MEMORY_SIZE && pinned != pinnedPages.end();
+            fuzz_check(VMunpin(address) == expected, "VMunpin returned wrongly");
+            if (expected && --pinned->second == 0) {
+                pinnedPages.erase(pinned);
+            }
+        }
+        else if (opcode == FUZZ_CHECK) {
+            fuzz_check(VMcheckConsistency() == 1, "the tables are inconsistent");
+        }
+        else if (opcode == FUZZ_DISCARD) {
+            uint64_t address = next_address(input);
+            uint64_t pages = next_value(input, 1);
+            bool expected = forget_pages(address, pages);
+            fuzz_check(VMdiscard(address, pages) == expected, "VMdiscard returned wrongly");
+        }
+        else if (opcode == FUZZ_CURSOR_SEEK) {
+            VMcursorInit(&cursor, next_address(input));
+        }
+        else if (opcode == FUZZ_CURSOR_READ) {
+            VMcursorMove(&cursor, (int8_t) next_value(input, 1));
+            int result = VMcursorRead(&cursor, &value);
+            check_access(result, cursor.address < VIRTUAL_MEMORY_SIZE,
+                         "VMcursorRead returned wrongly");
+            if (result) {
+                check_word(cursor.address, value);
+            }
+        }
+        else if (opcode == FUZZ_CURSOR_WRITE) {
+            VMcursorMove(&cursor, (int8_t) next_value(input, 1));
+            value = (word_t) next_value(input, 4);
+            int result = VMcursorWrite(&cursor, value);
+            check_access(result, cursor.address < VIRTUAL_MEMORY_SIZE,
+                         "VMcursorWrite returned wrongly");
+            if (result) {
+                knownWords[cursor.address] = value;
+            }
+        }
+        else if (opcode == FUZZ_FETCH_ADD) {
+            uint64_t address = next_address(input);
+            auto delta = (word_t) next_value(input, 4);
+            int result = VMfetchAdd(address, delta, &value);
+            check_access(result, address < VIRTUAL_MEMORY_SIZE, "VMfetchAdd returned wrongly");
+            if (result) {
+                check_word(address, value);
+                knownWords[address] = (word_t) ((uint64_t) value + (uint64_t) delta);
+            }
+        }
+        else if (opcode == FUZZ_COMPARE_EXCHANGE) {
+            uint64_t address = next_address(input);
+            bool useKnown = next_value(input, 1) & 1;
+            auto expected = (word_t) next_value(input, 4);
+            auto desired = (word_t) next_value(input, 4);
+
+            // half of the exchanges expect the value the word holds, so they succeed
+            auto known = knownWords.find(address);
+            if (useKnown && known != knownWords.end()) {
+                expected = known->second;
+            }
+
+            int result = VMcompareExchange(address, expected, desired, &value);
+            check_access(result, address < VIRTUAL_MEMORY_SIZE,
+                         "VMcompareExchange returned wrongly");
+            if (result) {
+                check_word(address, value);
+                if (value == expected) {
+                    knownWords[address] = desired;
+                }
+            }
+        }
+        else if (opcode == FUZZ_QUOTA) {
+            // up to one region past the last, and up to NUM_FRAMES frames, so quotas often bind
+            uint64_t region = next_value(input, 1) % (PAGE_SIZE + 1);
+            uint64_t minFrames = next_value(input, 2) % (NUM_FRAMES + 1);
+            uint64_t maxFrames = next_value(input, 2) % (NUM_FRAMES + 1);
+            bool valid = region < PAGE_SIZE &&
+                         (maxFrames == 0 || (maxFrames >= TABLES_DEPTH && minFrames <= maxFrames));
+            fuzz_check(VMsetRegionQuota(region, minFrames, maxFrames) == valid,
+                       "VMsetRegionQuota returned wrongly");
+            quotasSet = quotasSet || (valid && (minFrames != 0 || maxFrames != 0));
+        }
+        else if (opcode == FUZZ_ALLOC) {
+            uint64_t words = next_value(input, 2);
+            uint64_t address;
+            int result = VMalloc(words, &address);
+            fuzz_check(result == 0 || words != 0, "VMalloc allocated no words");
+            if (result) {
+                // small allocations stay on one page, large ones start a page
+                uint64_t end = address + words;
+                fuzz_check(end <= VIRTUAL_MEMORY_SIZE, "VMalloc allocated past the virtual memory");
+                fuzz_check(words <= PAGE_SIZE / 2 ? (address >> OFFSET_WIDTH) ==
+                                                        ((end - 1) >> OFFSET_WIDTH)
+                                                  : (address & (PAGE_SIZE - 1)) == 0,
+                           "VMalloc misplaced an allocation");
+
+                auto next = allocations.lower_bound(address);
+                fuzz_check(next == allocations.end() || next->first >= end,
+                           "VMalloc overlapped the next allocation");
+                fuzz_check(next == allocations.begin() ||
+                           std::prev(next)->first + std::prev(next)->second <= address,
+                           "VMalloc overlapped the previous allocation");
+
+                allocations[address] = words;
+                for (uint64_t page = address >> OFFSET_WIDTH; page <= (end - 1) >> OFFSET_WIDTH;
+                     page++) {
+                    heapPages[page]++;
+                }
+            }
+        }
+        else if (opcode == FUZZ_FREE) {
+            uint64_t index = next_value(input, 1);
+            uint64_t offset = next_value(input, 1) % 2;
+
+            // an allocation, or a word past its start (freed only if another allocation starts
+            // there)
+            uint64_t address = 0;
+            if (!allocations.empty()) {
+                auto chosen = allocations.begin();
+                std::advance(chosen, (int64_t) (index % allocations.size()));
+                address = chosen->first + offset;
+            }
+
+            auto allocation = allocations.find(address);
+            bool expected = allocation != allocations.end() && forget_allocation(allocation);
+            fuzz_check(VMfree(address) == expected, "VMfree returned wrongly");
+        }
+        else if (opcode == FUZZ_EXPORT) {
+            uint64_t address = next_address(input);
+            uint64_t pages = next_value(input, 1);
+
+            // export the pages, discard some of them and import them back - every known word is
+            // in the image, or in a page that reads as zeros
+            FILE* image = tmpfile();
+            fuzz_check(image != nullptr, "could not create the image file");
+            fuzz_check(VMexport(image) == 1, "VMexport failed");
+            rewind(image);
+
+            auto knownBefore = knownWords;
+            bool expected = forget_pages(address, pages);
+            fuzz_check(VMdiscard(address, pages) == expected, "VMdiscard returned wrongly");
+            fuzz_check(VMimport(image) == 1, "VMimport failed");
+            fclose(image);
+            knownWords = knownBefore;
+        }
+        else if (opcode == FUZZ_TRANSLATE) {
+            uint64_t address = next_address(input);
+            int writable = (int) (next_value(input, 1) & 1);
+            value = (word_t) next_value(input, 4);
+
+            // a page that is not admitted is not translated
+            uint64_t physicalAddress;
+            int result = VMtranslate(address, writable, &physicalAddress);
+#ifdef VM_ADMISSION_FILTER
+            fuzz_check(result == 0 || address < VIRTUAL_MEMORY_SIZE, "VMtranslate returned wrongly");
+#else
+            check_access(result, address < VIRTUAL_MEMORY_SIZE, "VMtranslate returned wrongly");
+#endif
+            if (result) {
+                word_t physicalValue;
+                PMread(physicalAddress, &physicalValue);
+                check_word(address, physicalValue);
+                if (writable) {
+                    PMwrite(physicalAddress, value);
+                    knownWords[address] = value;
+                }
+            }
+        }
+        else {
+            uint64_t address = next_address(input);
+            auto desired = (word_t) next_value(input, 4);
+            int result = VMexchange(address, desired, &value);
+            check_access(result, address < VIRTUAL_MEMORY_SIZE, "VMexchange returned wrongly");
+            if (result) {
+                check_word(address, value);
+                knownWords[address] = desired;
+            }
+        }
+    }
+
+    // every known word is still there, wherever it was paged to
+    fuzz_check(VMcheckConsistency() == 1, "the tables are inconsistent");
+    for (auto& known : knownWords) {
+        word_t value;
+        int result = VMread(known.first, &value);
+        check_access(result, true, "VMread failed");
+        fuzz_check(result == 0 || value == known.second,
+                   "read another value than the one last written");
+    }
+}
+
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+#if FUZZ_DIFFERENTIAL
+    Input differential = {data, size, 0};
+    reset_memories();
+    run_differential(&differential);
+#endif
+
+    Input operations = {data, size, 0};
+    reset_memories();
+    run_operations(&operations);
+    return 0;
+}
+
+
+#ifdef VM_FUZZ_MAIN
+/**
+ * Runs an input read from a file
+ *
+ * @param file The file
+ */
+void run_file(FILE* file) {
+    std::vector<uint8_t> data;
+    int byte;
+    while ((byte = fgetc(file)) != EOF) {
+        data.push_back((uint8_t) byte);
+    }
+    LLVMFuzzerTestOneInput(data.data(), data.size());
+}
+
+
+int main(int argc, char** argv) {
+    if (argc == 1) {
+        run_file(stdin);
+        return 0;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        FILE* file = fopen(argv[i], "rb");
+        if (file == nullptr) {
+            fprintf(stderr, "VirtualMemoryFuzzer: cannot open %s\n", argv[i]);
+            return 1;
+        }
+        run_file(file);
+        fclose(file);
+    }
+    return 0;
+}
+#endif